@@ -15,10 +15,17 @@
 #include <stdlib.h>
 #include <syslog.h>
 #include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <zlib.h>
+#include <notify.h>
 
 #include <ifaddrs.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
 
 #include <net/if.h>
 #include <net/if_dl.h>
@@ -28,11 +35,15 @@
 #include <sys/socket.h> /* Needed for net/if.h ! */
 #include <sys/types.h>
 #include <sys/sysctl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #include <mach/mach_init.h>
 #include <mach/mach_host.h>
 #include <mach/host_info.h>
 #include <mach/vm_map.h>
+#include <mach/mach_port.h>
+#include <mach/processor_set.h>
 
 #define IPCONFIGURATION_BUNDLE_PATH \
 "/System/Library/SystemConfiguration/IPConfiguration.bundle/IPConfiguration"
@@ -71,23 +82,33 @@ libsstats_get_cpu(libsstats_cpu *buf)
     /* Loop through all processors an fill the user buf. */
     unsigned i;
     for (i = 0; i < pcount; i++) {
-        buf->xcpu_user[i]   = pinfo[i].cpu_ticks[CPU_STATE_USER];
-		buf->xcpu_sys[i]    = pinfo[i].cpu_ticks[CPU_STATE_SYSTEM];
-		buf->xcpu_idle[i]   = pinfo[i].cpu_ticks[CPU_STATE_IDLE];
-		buf->xcpu_nice[i]   = pinfo[i].cpu_ticks[CPU_STATE_NICE];
-		buf->xcpu_total[i]  = buf->xcpu_user[i] + buf->xcpu_sys[i] +
+        uint64_t user = pinfo[i].cpu_ticks[CPU_STATE_USER];
+        uint64_t sys  = pinfo[i].cpu_ticks[CPU_STATE_SYSTEM];
+        uint64_t idle = pinfo[i].cpu_ticks[CPU_STATE_IDLE];
+        uint64_t nice = pinfo[i].cpu_ticks[CPU_STATE_NICE];
         
-        buf->xcpu_idle[i]   + buf->xcpu_nice[i];
+		buf->user           += user;
+		buf->sys            += sys;
+		buf->idle           += idle;
+		buf->nice           += nice;
+		buf->total          += user + sys + idle + nice;
         
-		buf->user           += buf->xcpu_user[i];
-		buf->sys            += buf->xcpu_sys[i];
-		buf->idle           += buf->xcpu_idle[i];
-		buf->nice           += buf->xcpu_nice[i];
-		buf->total          += buf->xcpu_total[i];
+        /* The totals cover every CPU; the per-CPU slots stop at
+         * LIBSSTATS_NCPU. */
+        if (i >= LIBSSTATS_NCPU)
+            continue;
+        
+        buf->xcpu_user[i]   = user;
+		buf->xcpu_sys[i]    = sys;
+		buf->xcpu_idle[i]   = idle;
+		buf->xcpu_nice[i]   = nice;
+		buf->xcpu_total[i]  = user + sys + idle + nice;
     }
     
     vm_deallocate (mach_task_self(), (vm_address_t)pinfo, icount);
     
+    /* Rate of the cpu_ticks counters above, not the clock speed; see
+     * libsstats_get_cpufreq() for that. */
 	buf->frequency = 100;
 }
 
@@ -138,9 +159,45 @@ libsstats_get_cpu_percentage(libsstats_cpu cpu, libsstats_cpu_percentage *buf,
     buf->idle_cpu_percentage = idle_percent;
 }
 
+static struct kinfo_proc *proc_fetch(int *mib, size_t miblen, int *nprocs);
+
+/* Darwin has no runnable-task counter or last-pid sysctl, so both come
+ * from one KERN_PROC_ALL snapshot: the processes in SRUN, and the pid of
+ * the most recently started process. Either pointer may be NULL. */
+static void
+proc_scan_running(uint64_t *nr_running, uint64_t *last_pid)
+{
+    int mib[] = { CTL_KERN, KERN_PROC, KERN_PROC_ALL, 0 };
+    struct kinfo_proc *procs;
+    struct timeval newest;
+    int i, nprocs;
+    
+    procs = proc_fetch(mib, 4, &nprocs);
+    if (!procs) {
+        return;
+    }
+    
+    timerclear(&newest);
+    for (i = 0; i < nprocs; i++) {
+        const struct extern_proc *p = &procs[i].kp_proc;
+        
+        if (nr_running && p->p_stat == SRUN)
+            (*nr_running)++;
+        if (last_pid && timercmp(&p->p_starttime, &newest, >)) {
+            newest = p->p_starttime;
+            *last_pid = p->p_pid;
+        }
+    }
+    
+    free(procs);
+}
+
 void
 libsstats_get_loadavg(libsstats_loadavg *buf)
 {
+    struct processor_set_load_info load;
+    mach_msg_type_number_t count = PROCESSOR_SET_LOAD_INFO_COUNT;
+    processor_set_name_t pset;
     double ldavg[3];
     int i;
     
@@ -153,456 +210,3044 @@ libsstats_get_loadavg(libsstats_loadavg *buf)
     for (i = 0; i < 3; i++) {
         buf->loadavg[i] = ldavg[i];
     }    
+    
+    /* Tasks and threads as counted by the scheduler. */
+    if (processor_set_default(mach_host_self(), &pset) == KERN_SUCCESS) {
+        if (processor_set_statistics(pset, PROCESSOR_SET_LOAD_INFO,
+                                     (processor_set_info_t)&load,
+                                     &count) == KERN_SUCCESS) {
+            buf->nr_tasks   = load.task_count;
+            buf->nr_threads = load.thread_count;
+        }
+        mach_port_deallocate(mach_task_self(), pset);
+    }
+    
+    proc_scan_running(&buf->nr_running, &buf->last_pid);
 }
 
 // -----------------------------------------------------------------------------
-#pragma mark Net
+#pragma mark Scheduler
 // -----------------------------------------------------------------------------
 
-char **
-libsstats_get_netlist(libsstats_netlist *buf)
+/* /proc/stat and /proc/schedstat are Linux only. Darwin keeps no
+ * context-switch, fork or per-CPU run-queue counters a user process can
+ * read, so there only procs_running is filled in. */
+#ifdef __linux__
+
+#define PROC_STAT_PATH          "/proc/stat"
+#define PROC_SCHEDSTAT_PATH     "/proc/schedstat"
+
+static uint64_t
+sched_parse_u64(const char **pp)
 {
-    struct if_nameindex *ifstart, *ifs;
-    static char *devices[LIBSSTATS_MAX_NETDEVICES];
-    
-    memset (buf, 0, sizeof (libsstats_netlist));
+    const char *p = *pp;
+    uint64_t v = 0;
     
-    ifs = ifstart = if_nameindex();
-    while(ifs && ifs->if_name) {
-        devices[buf->number] = ifs->if_name;
-        buf->number++;
-        ifs++;
-    }
+    while (*p == ' ')
+        p++;
+    while (*p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
     
-    return (char **)devices;
+    *pp = p;
+    return v;
 }
 
+enum {
+    SCHED_CTXT = 0,
+    SCHED_RUN_TIME,
+    SCHED_WAIT_TIME,
+    SCHED_TIMESLICES,
+    SCHED_NFIELDS
+};
 
-void libsstats_get_netload(libsstats_netload *buf, const char *intf)
+enum {
+    SCHED_RATE_CTXT = 0,
+    SCHED_RATE_WAIT,
+    SCHED_RATE_WAIT_PER_SLICE,
+    SCHED_RATE_TIMESLICES,
+    SCHED_NRATES
+};
+
+/* sched_seen flags per CPU: listed in the current and previous sample. */
+#define SCHED_SEEN_PREV         1
+#define SCHED_SEEN_NOW          2
+
+/* One array per field, indexed by CPU number and grown to the highest
+ * CPU seen in /proc/schedstat. The previous sample is kept for rates;
+ * a CPU missing from a sample keeps its previous counters. */
+static uint32_t  sched_capacity = 0;
+static uint64_t *sched_counts[SCHED_NFIELDS];
+static uint64_t *sched_prev[SCHED_NFIELDS];
+static double   *sched_rates[SCHED_NRATES];
+static uint8_t  *sched_seen;
+static uint64_t  sched_prev_ctxt = 0;
+static uint64_t  sched_prev_forks = 0;
+static double    sched_stamp = 0;
+
+static int
+sched_grow(uint32_t ncpu)
 {
-	int mib[] = { CTL_NET, PF_ROUTE, 0, 0, NET_RT_IFLIST, 0 };
-    size_t bufsize;
-	char *rtbuf, *ptr, *eob;
-	struct if_msghdr *ifm;
-        
-	memset(buf, 0, sizeof (libsstats_netload));
-	if (sysctl(mib, 6, NULL, &bufsize, NULL, 0) < 0)
-		return;
-    
-	rtbuf = (char *)malloc(bufsize);
-	if (rtbuf == NULL)
-		return;
+    uint32_t capacity = sched_capacity ? sched_capacity : 64;
+    int i;
     
-	if (sysctl(mib, 6, rtbuf, &bufsize, NULL, 0) < 0) {
-		free(rtbuf);
-		return;
-	}
+    while (capacity < ncpu)
+        capacity *= 2;
     
-	eob = rtbuf + bufsize;
-	ptr = rtbuf;
-	while (ptr < eob) {
-		struct sockaddr_dl *sdl;
-        
-		ifm = (struct if_msghdr *)ptr;
-        
-		if (ifm->ifm_type != RTM_IFINFO)
-			break;
-		ptr += ifm->ifm_msglen;
+    for (i = 0; i < SCHED_NFIELDS; i++) {
+        uint64_t *counts, *prev;
         
-		while (ptr < eob) {
-			struct if_msghdr *nextifm = (struct if_msghdr *)ptr;
-            
-			if (nextifm->ifm_type != RTM_NEWADDR)
-				break;
-			ptr += nextifm->ifm_msglen;
-		}
+        counts = (uint64_t *)realloc(sched_counts[i],
+                                     capacity * sizeof (uint64_t));
+        if (counts)
+            sched_counts[i] = counts;
+        prev = (uint64_t *)realloc(sched_prev[i], capacity * sizeof (uint64_t));
+        if (prev)
+            sched_prev[i] = prev;
+        if (!counts || !prev)
+            goto FAILED;
         
-		sdl = (struct sockaddr_dl *)(ifm + 1);
-        if (sdl->sdl_family != AF_LINK)
-			continue;
-		
-        if (strlen(intf) != sdl->sdl_nlen)
-			continue;
-
-        if (strncmp(intf, "en", 2) == 0)
-        {
-            if (strncmp(intf, sdl->sdl_data, 3) == 0)
-                goto FOUND;
-        }
-        else
-        {
-            if (strcmp(intf, sdl->sdl_data) == 0) // TODO
-			goto FOUND;
-        }
-	}
-	free (rtbuf);
-	return;
+        memset (counts + sched_capacity, 0,
+                (capacity - sched_capacity) * sizeof (uint64_t));
+        memset (prev + sched_capacity, 0,
+                (capacity - sched_capacity) * sizeof (uint64_t));
+    }
     
-FOUND:
-	if (ifm->ifm_flags & IFF_UP)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_UP;
-	if (ifm->ifm_flags & IFF_BROADCAST)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_BROADCAST;
-	if (ifm->ifm_flags & IFF_DEBUG)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_DEBUG;
-	if (ifm->ifm_flags & IFF_LOOPBACK)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_LOOPBACK;
-	if (ifm->ifm_flags & IFF_POINTOPOINT)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_POINTOPOINT;
-	if (ifm->ifm_flags & IFF_RUNNING)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_RUNNING;
-	if (ifm->ifm_flags & IFF_NOARP)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_NOARP;
-	if (ifm->ifm_flags & IFF_NOARP)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_PROMISC;
-	if (ifm->ifm_flags & IFF_ALLMULTI)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_ALLMULTI;
-	if (ifm->ifm_flags & IFF_OACTIVE)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_OACTIVE;
-	if (ifm->ifm_flags & IFF_SIMPLEX)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_SIMPLEX;
-	if (ifm->ifm_flags & IFF_LINK0)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_LINK0;
-	if (ifm->ifm_flags & IFF_LINK1)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_LINK1;
-	if (ifm->ifm_flags & IFF_LINK2)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_LINK2;
-	if (ifm->ifm_flags & IFF_ALTPHYS)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_ALTPHYS;
-	if (ifm->ifm_flags & IFF_MULTICAST)
-		buf->if_flags |= LIBSSTATS_IF_FLAGS_MULTICAST;
-	buf->mtu            = ifm->ifm_data.ifi_mtu;
-	buf->subnet         = 0; /* FIXME */
-	buf->address		= 0; /* FIXME */
-	buf->packets_in		= ifm->ifm_data.ifi_ipackets;
-	buf->packets_out	= ifm->ifm_data.ifi_opackets;
-	buf->packets_total	= buf->packets_in + buf->packets_out;
-	buf->bytes_in		= ifm->ifm_data.ifi_ibytes;
-	buf->bytes_out		= ifm->ifm_data.ifi_obytes;
-	buf->bytes_total	= buf->bytes_in + buf->bytes_out;
-	buf->errors_in		= ifm->ifm_data.ifi_ierrors;
-	buf->errors_out		= ifm->ifm_data.ifi_oerrors;
-	buf->errors_total	= buf->errors_in + buf->errors_out;
-	buf->collisions		= ifm->ifm_data.ifi_collisions;
+    for (i = 0; i < SCHED_NRATES; i++) {
+        double *rates = (double *)realloc(sched_rates[i],
+                                          capacity * sizeof (double));
+        if (rates == NULL)
+            goto FAILED;
+        sched_rates[i] = rates;
+    }
+    
+    {
+        uint8_t *seen = (uint8_t *)realloc(sched_seen, capacity);
+        if (seen == NULL)
+            goto FAILED;
+        memset (seen + sched_capacity, 0, capacity - sched_capacity);
+        sched_seen = seen;
+    }
+    
+    sched_capacity = capacity;
+    return 0;
+    
+FAILED:
+    syslog(1, "libsysstats: Error: realloc failed.");
+    return -1;
 }
 
-void
-libsstats_get_mac(const char *intf, libsstats_mac *buf)
+static void
+sched_sample(libsstats_sched *buf)
 {
-    int success;
-    struct ifaddrs *addrs;
-    struct ifaddrs *cursor;
-    const struct sockaddr_dl *sock_addr;
-    const unsigned char *base;
-    int i;
+    char line[512];
+    const char *p;
+    struct timeval now;
+    double stamp, dt;
+    int line_start;
+    uint32_t i, ncpu = 0;
+    FILE *f;
     
-    memset (buf, 0, sizeof (libsstats_mac));
+    gettimeofday(&now, NULL);
+    stamp = now.tv_sec + now.tv_usec / 1000000.0;
     
-    success = (getifaddrs(&addrs) == 0);
-    if (!success) {
-        return;
+    /* The "intr" line of /proc/stat is longer than any sane buffer, so
+     * only look at chunks that start a new line. */
+    f = fopen(PROC_STAT_PATH, "r");
+    if (f) {
+        line_start = 1;
+        while (fgets(line, sizeof (line), f)) {
+            int at_start = line_start;
+            
+            line_start = (strchr(line, '\n') != NULL);
+            if (!at_start || (line[0] == 'c' && line[1] == 'p'))
+                continue;
+            
+            p = strchr(line, ' ');
+            if (p == NULL)
+                continue;
+            
+            if (strncmp(line, "ctxt ", 5) == 0)
+                buf->ctxt = sched_parse_u64(&p);
+            else if (strncmp(line, "processes ", 10) == 0)
+                buf->forks = sched_parse_u64(&p);
+            else if (strncmp(line, "procs_running ", 14) == 0)
+                buf->procs_running = sched_parse_u64(&p);
+            else if (strncmp(line, "procs_blocked ", 14) == 0)
+                buf->procs_blocked = sched_parse_u64(&p);
+        }
+        fclose(f);
     }
     
-    cursor = addrs;
-    while (cursor != 0) {
-        if ((cursor->ifa_addr->sa_family == AF_LINK)
-            && (((const struct sockaddr_dl *)cursor->ifa_addr)->sdl_type == IFT_ETHER)
-            && strcmp(intf,  cursor->ifa_name) == 0) {
-            sock_addr = (const struct sockaddr_dl *)cursor->ifa_addr;
-            base = (const unsigned char *)&sock_addr->sdl_data[sock_addr->sdl_nlen];
-            strcpy(buf->macaddress, ""); 
-            for (i = 0; i < sock_addr->sdl_alen; i++) {
-                if (i != 0) {
-                    strcat(buf->macaddress, ":");
-                }
-                char partialAddr[3];
-                sprintf(partialAddr, "%02x", base[i]);  // TODO
-                strcat(buf->macaddress, partialAddr);   // TODO
-            }
+    for (i = 0; i < SCHED_NFIELDS && sched_capacity; i++)
+        memset (sched_counts[i], 0, sched_capacity * sizeof (uint64_t));
+    
+    /* cpu<N> yld_count legacy sched_count sched_goidle ttwu_count
+     *        ttwu_local rq_cpu_time run_delay pcount */
+    f = fopen(PROC_SCHEDSTAT_PATH, "r");
+    if (f) {
+        while (fgets(line, sizeof (line), f)) {
+            uint64_t field[9];
+            uint32_t cpu;
+            
+            if (strncmp(line, "cpu", 3) != 0)
+                continue;
+            
+            p = line + 3;
+            cpu = (uint32_t)sched_parse_u64(&p);
+            if (cpu >= sched_capacity && sched_grow(cpu + 1) < 0)
+                continue;
+            
+            for (i = 0; i < 9; i++)
+                field[i] = sched_parse_u64(&p);
+            
+            sched_counts[SCHED_CTXT][cpu]       = field[2];
+            sched_counts[SCHED_RUN_TIME][cpu]   = field[6];
+            sched_counts[SCHED_WAIT_TIME][cpu]  = field[7];
+            sched_counts[SCHED_TIMESLICES][cpu] = field[8];
+            sched_seen[cpu] |= SCHED_SEEN_NOW;
+            
+            if (cpu + 1 > ncpu)
+                ncpu = cpu + 1;
         }
-        cursor = cursor->ifa_next;
+        fclose(f);
     }
     
-    freeifaddrs(addrs);
-}
-
-void
-libsstats_get_ip(const char *intf, libsstats_ip *buf)
-{
-    struct ifaddrs *interfaces = NULL;
-    struct ifaddrs *temp_addr = NULL;
-    int success = 0;
+    dt = sched_stamp > 0 ? stamp - sched_stamp : 0;
     
-    memset (buf, 0, sizeof (libsstats_ip));
-
-    strncpy(buf->ipaddress, "N/A", 4);
+#define SCHED_DELTA(cur, prev) \
+    ((cur) >= (prev) ? (double)((cur) - (prev)) : 0)
     
-    success = getifaddrs(&interfaces);
-    if (success == 0)
-    {
-        temp_addr = interfaces;
-        while(temp_addr != NULL)
-        {
-            if(temp_addr->ifa_addr->sa_family == AF_INET)
-            {
-                if (strcmp(temp_addr->ifa_name, intf) == 0) // TODO
-                {
-                    strcpy(buf->ipaddress,
-                           inet_ntoa(((struct sockaddr_in *)temp_addr->ifa_addr)->sin_addr)); // TODO
-                }
-            }
-            
-            temp_addr = temp_addr->ifa_next;
+    if (dt > 0) {
+        buf->ctxt_rate  = SCHED_DELTA(buf->ctxt, sched_prev_ctxt) / dt;
+        buf->forks_rate = SCHED_DELTA(buf->forks, sched_prev_forks) / dt;
+    }
+    
+    for (i = 0; i < sched_capacity; i++) {
+        double slices = 0, wait = 0, ctxt = 0;
+        int j;
+        
+        /* An offline CPU keeps its previous counters, and one that just
+         * came (back) online has no rate yet. */
+        if (!(sched_seen[i] & SCHED_SEEN_NOW)) {
+            for (j = 0; j < SCHED_NRATES; j++)
+                sched_rates[j][i] = 0;
+            sched_seen[i] = 0;
+            continue;
+        }
+        
+        if (dt > 0 && (sched_seen[i] & SCHED_SEEN_PREV)) {
+            slices = SCHED_DELTA(sched_counts[SCHED_TIMESLICES][i],
+                                 sched_prev[SCHED_TIMESLICES][i]);
+            wait   = SCHED_DELTA(sched_counts[SCHED_WAIT_TIME][i],
+                                 sched_prev[SCHED_WAIT_TIME][i]);
+            ctxt   = SCHED_DELTA(sched_counts[SCHED_CTXT][i],
+                                 sched_prev[SCHED_CTXT][i]);
         }
+        
+        sched_rates[SCHED_RATE_CTXT][i]       = dt > 0 ? ctxt / dt : 0;
+        sched_rates[SCHED_RATE_WAIT][i]       = dt > 0 ? wait / dt : 0;
+        sched_rates[SCHED_RATE_TIMESLICES][i] = dt > 0 ? slices / dt : 0;
+        sched_rates[SCHED_RATE_WAIT_PER_SLICE][i]
+        = slices > 0 ? wait / slices : 0;
+        
+        for (j = 0; j < SCHED_NFIELDS; j++)
+            sched_prev[j][i] = sched_counts[j][i];
+        sched_seen[i] = SCHED_SEEN_PREV;
     }
     
-    freeifaddrs(interfaces);
+#undef SCHED_DELTA
+    
+    sched_prev_ctxt  = buf->ctxt;
+    sched_prev_forks = buf->forks;
+    sched_stamp      = stamp;
+    
+    if (ncpu == 0)
+        return;
+    
+    buf->ncpu                = ncpu;
+    buf->xcpu_ctxt           = sched_counts[SCHED_CTXT];
+    buf->xcpu_run_time       = sched_counts[SCHED_RUN_TIME];
+    buf->xcpu_wait_time      = sched_counts[SCHED_WAIT_TIME];
+    buf->xcpu_timeslices     = sched_counts[SCHED_TIMESLICES];
+    buf->xcpu_ctxt_rate      = sched_rates[SCHED_RATE_CTXT];
+    buf->xcpu_wait_rate      = sched_rates[SCHED_RATE_WAIT];
+    buf->xcpu_wait_per_slice = sched_rates[SCHED_RATE_WAIT_PER_SLICE];
+    buf->xcpu_timeslice_rate = sched_rates[SCHED_RATE_TIMESLICES];
 }
 
-// -----------------------------------------------------------------------------
-#pragma mark Memory
-// -----------------------------------------------------------------------------
+#endif /* __linux__ */
 
 void
-libsstats_get_mem(libsstats_mem *buf)
+libsstats_get_sched(libsstats_sched *buf)
 {
-	vm_statistics_data_t vm_info;
-	mach_msg_type_number_t info_count;
-        
-	memset (buf, 0, sizeof (libsstats_mem));
+    memset (buf, 0, sizeof (libsstats_sched));
     
-	info_count = HOST_VM_INFO_COUNT;
-	if (host_statistics(mach_host_self(), HOST_VM_INFO,
-                         (host_info_t)&vm_info, &info_count)) {
-		return;
-	}
-    
-    float active_count   = vm_info.active_count   * vm_page_size / 1048576.0;
-    float inactive_count = vm_info.inactive_count * vm_page_size / 1048576.0;
-    float wire_count     = vm_info.wire_count     * vm_page_size / 1048576.0;
-    float total_count    = (vm_info.active_count
-                         +  vm_info.inactive_count
-                         +  vm_info.free_count
-                         +  vm_info.wire_count)    * vm_page_size / 1048576.0;
-    float free_count     = vm_info.free_count      * vm_page_size / 1048576.0;
-    float used_count     = total_count - free_count               / 1048576.0;
-    buf->active             = active_count;
-    buf->inactive           = inactive_count;
-    buf->wired              = wire_count;
-    buf->total              = total_count;
-    buf->free               = free_count;
-    buf->used               = used_count;
+#ifdef __linux__
+    sched_sample(buf);
+#else
+    proc_scan_running(&buf->procs_running, NULL);
+#endif
 }
 
-
 // -----------------------------------------------------------------------------
-#pragma mark Wireless
+#pragma mark Frequency
+// -----------------------------------------------------------------------------
+
+/* Linux has per-core cpufreq, throttle counters and thermal zones in
+ * sysfs. Darwin has none of these; there the collector reports the clock
+ * from hw.cpufrequency* and the thermal pressure level instead. */
+#ifdef __linux__
+
+#define SYSFS_CPU_PATH          "/sys/devices/system/cpu"
+#define SYSFS_THERMAL_PATH      "/sys/class/thermal"
+
+/* Share of RLIMIT_NOFILE this collector may keep open. Attributes that
+ * don't fit are opened, read and closed on every sample instead. */
+#define FREQ_FD_SHARE           4
+
+enum {
+    FREQ_CUR = 0,
+    FREQ_CORE_THROTTLE,
+    FREQ_MIN,
+    FREQ_MAX,
+    FREQ_NATTRS
+};
+
+enum {
+    FREQ_ABSENT = 0,
+    FREQ_OPEN,
+    FREQ_REOPEN
+};
+
+/* Ordered by how useful they are, which is the order descriptors are
+ * handed out in. */
+static const char *freq_files[FREQ_NATTRS] = {
+    "cpufreq/scaling_cur_freq",
+    "thermal_throttle/core_throttle_count",
+    "cpufreq/scaling_min_freq",
+    "cpufreq/scaling_max_freq"
+};
+
+#define FREQ_PACKAGE_FILE       "thermal_throttle/package_throttle_count"
+
+/* `path' is only kept for FREQ_REOPEN attributes. */
+typedef struct {
+    int         fd;
+    int         state;
+    char        *path;
+} freq_attr;
+
+/* package_throttle_count is the same counter on every core of a
+ * package, so it is read once per physical_package_id. */
+typedef struct {
+    int         id;
+    uint32_t    cpu;
+    freq_attr   attr;
+    uint64_t    count;
+} freq_package;
+
+/* The sysfs attributes are opened once and re-read with pread(), so a
+ * sample costs one syscall per value instead of open/read/close. The
+ * cpu `online' and `present' masks are re-read every sample and a
+ * change triggers a rescan, which picks up hotplugged cores. */
+static int                freq_scanned = 0;
+static int                freq_budget = 0;
+static int                freq_online_fd = -1;
+static int                freq_present_fd = -1;
+static char               freq_mask[512];
+static uint32_t           freq_ncpu = 0;
+static libsstats_corefreq *freq_cores = NULL;
+static freq_attr         *freq_attrs = NULL;
+static int               *freq_core_package = NULL;
+static uint32_t           freq_npackages = 0;
+static freq_package      *freq_packages = NULL;
+static uint32_t           freq_nzones = 0;
+static freq_attr         *freq_zone_attrs = NULL;
+static libsstats_thermal *freq_zones = NULL;
+
+static void
+freq_path(char *path, size_t size, const char *dir, const char *name,
+          const char *file)
+{
+    snprintf(path, size, "%s/%s/%s", dir, name, file);
+}
+
+/* Opens an attribute, keeping the descriptor if the budget allows. */
+static void
+freq_attr_open(freq_attr *attr, const char *path)
+{
+    int fd;
+    
+    attr->fd = -1;
+    attr->state = FREQ_ABSENT;
+    attr->path = NULL;
+    
+    if (freq_budget <= 0) {
+        if (access(path, R_OK) == 0) {
+            attr->path = strdup(path);
+            if (attr->path)
+                attr->state = FREQ_REOPEN;
+        }
+        return;
+    }
+    
+    fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        attr->fd = fd;
+        attr->state = FREQ_OPEN;
+        freq_budget--;
+        return;
+    }
+    
+    if (errno == EMFILE || errno == ENFILE) {
+        /* The process is out of descriptors: stop holding any more and
+         * leave the rest to the host application. */
+        syslog(1, "libsysstats: cpufreq: out of file descriptors, "
+                  "reopening attributes per sample.");
+        freq_budget = 0;
+        attr->path = strdup(path);
+        if (attr->path)
+            attr->state = FREQ_REOPEN;
+    }
+}
+
+static void
+freq_attr_close(freq_attr *attr)
+{
+    if (attr->state == FREQ_OPEN)
+        close(attr->fd);
+    free(attr->path);
+    attr->fd = -1;
+    attr->state = FREQ_ABSENT;
+    attr->path = NULL;
+}
+
+static int
+freq_parse_value(const char *text, int64_t *value)
+{
+    const char *p = text;
+    int64_t v = 0;
+    int neg = 0;
+    
+    if (*p == '-') {
+        neg = 1;
+        p++;
+    }
+    if (*p < '0' || *p > '9')
+        return -1;
+    while (*p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
+    
+    *value = neg ? -v : v;
+    return 0;
+}
+
+static int
+freq_read_fd(int fd, char *text, size_t size)
+{
+    ssize_t n = pread(fd, text, size - 1, 0);
+    
+    if (n <= 0)
+        return -1;
+    text[n] = '\0';
+    return 0;
+}
+
+static int
+freq_attr_read(freq_attr *attr, int64_t *value)
+{
+    char text[32];
+    int fd, ret;
+    
+    switch (attr->state) {
+    case FREQ_OPEN:
+        ret = freq_read_fd(attr->fd, text, sizeof (text));
+        break;
+    case FREQ_REOPEN:
+        fd = open(attr->path, O_RDONLY);
+        if (fd < 0)
+            return -1;
+        ret = freq_read_fd(fd, text, sizeof (text));
+        close(fd);
+        break;
+    default:
+        return -1;
+    }
+    
+    if (ret < 0)
+        return -1;
+    return freq_parse_value(text, value);
+}
+
+static uint64_t
+freq_attr_count(freq_attr *attr)
+{
+    int64_t v;
+    
+    if (freq_attr_read(attr, &v) < 0 || v < 0)
+        return 0;
+    return (uint64_t)v;
+}
+
+static int
+freq_cmp_cpu(const void *a, const void *b)
+{
+    const libsstats_corefreq *x = a, *y = b;
+    
+    return (x->cpu > y->cpu) - (x->cpu < y->cpu);
+}
+
+/* Returns the concatenated online and present masks, or "" if sysfs
+ * doesn't have them. */
+static void
+freq_read_mask(char *mask, size_t size)
+{
+    size_t len;
+    
+    mask[0] = '\0';
+    if (freq_online_fd >= 0)
+        freq_read_fd(freq_online_fd, mask, size / 2);
+    len = strlen(mask);
+    if (freq_present_fd >= 0)
+        freq_read_fd(freq_present_fd, mask + len, size - len);
+}
+
+static void
+freq_release(void)
+{
+    uint32_t i;
+    
+    for (i = 0; freq_attrs && i < freq_ncpu * FREQ_NATTRS; i++)
+        freq_attr_close(&freq_attrs[i]);
+    for (i = 0; i < freq_npackages; i++)
+        freq_attr_close(&freq_packages[i].attr);
+    for (i = 0; i < freq_nzones; i++)
+        freq_attr_close(&freq_zone_attrs[i]);
+    
+    free(freq_cores);
+    free(freq_attrs);
+    free(freq_core_package);
+    free(freq_packages);
+    free(freq_zones);
+    free(freq_zone_attrs);
+    freq_cores = NULL;
+    freq_attrs = NULL;
+    freq_core_package = NULL;
+    freq_packages = NULL;
+    freq_zones = NULL;
+    freq_zone_attrs = NULL;
+    freq_ncpu = freq_npackages = freq_nzones = 0;
+}
+
+/* Finds cpu<N> and thermal_zone<N> directories and opens their
+ * attributes, most useful ones first, within the descriptor budget. */
+static void
+freq_scan(void)
+{
+    struct dirent *ent;
+    struct rlimit rl;
+    uint32_t capacity, i, j;
+    char path[256], name[16];
+    DIR *dir;
+    
+    freq_release();
+    freq_scanned = 1;
+    
+    freq_budget = 256;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        freq_budget = (int)(rl.rlim_cur / FREQ_FD_SHARE);
+    
+    if (freq_online_fd < 0)
+        freq_online_fd = open(SYSFS_CPU_PATH "/online", O_RDONLY);
+    if (freq_present_fd < 0)
+        freq_present_fd = open(SYSFS_CPU_PATH "/present", O_RDONLY);
+    freq_read_mask(freq_mask, sizeof (freq_mask));
+    
+    dir = opendir(SYSFS_CPU_PATH);
+    if (dir) {
+        capacity = 0;
+        while ((ent = readdir(dir)) != NULL) {
+            libsstats_corefreq *cores;
+            
+            if (strncmp(ent->d_name, "cpu", 3) != 0
+                || ent->d_name[3] < '0' || ent->d_name[3] > '9')
+                continue;
+            
+            if (freq_ncpu == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                cores = (libsstats_corefreq *)realloc(freq_cores,
+                            capacity * sizeof (libsstats_corefreq));
+                if (cores == NULL)
+                    break;
+                freq_cores = cores;
+            }
+            memset (&freq_cores[freq_ncpu], 0, sizeof (libsstats_corefreq));
+            freq_cores[freq_ncpu].cpu = (uint32_t)atoi(ent->d_name + 3);
+            freq_ncpu++;
+        }
+        closedir(dir);
+        
+        qsort(freq_cores, freq_ncpu, sizeof (libsstats_corefreq),
+              freq_cmp_cpu);
+        
+        freq_attrs = (freq_attr *)calloc(freq_ncpu * FREQ_NATTRS,
+                                         sizeof (freq_attr));
+        freq_core_package = (int *)calloc(freq_ncpu, sizeof (int));
+        freq_packages = (freq_package *)calloc(freq_ncpu,
+                                               sizeof (freq_package));
+        if (!freq_attrs || !freq_core_package || !freq_packages) {
+            freq_release();
+            return;
+        }
+        
+        /* One package entry per physical_package_id. */
+        for (i = 0; i < freq_ncpu; i++) {
+            char text[32];
+            int64_t id = -1;
+            int fd;
+            
+            snprintf(name, sizeof (name), "cpu%u", freq_cores[i].cpu);
+            freq_path(path, sizeof (path), SYSFS_CPU_PATH, name,
+                      "topology/physical_package_id");
+            fd = open(path, O_RDONLY);
+            if (fd >= 0) {
+                if (freq_read_fd(fd, text, sizeof (text)) == 0)
+                    freq_parse_value(text, &id);
+                close(fd);
+            }
+            
+            for (j = 0; j < freq_npackages; j++) {
+                if (freq_packages[j].id == id)
+                    break;
+            }
+            if (j == freq_npackages) {
+                freq_packages[j].id = (int)id;
+                freq_packages[j].cpu = freq_cores[i].cpu;
+                freq_npackages++;
+            }
+            freq_core_package[i] = (int)j;
+        }
+        
+        /* Hand out descriptors attribute by attribute across all cores,
+         * so a tight budget still covers scaling_cur_freq everywhere. */
+        for (j = 0; j < FREQ_NATTRS; j++) {
+            for (i = 0; i < freq_ncpu; i++) {
+                snprintf(name, sizeof (name), "cpu%u", freq_cores[i].cpu);
+                freq_path(path, sizeof (path), SYSFS_CPU_PATH, name,
+                          freq_files[j]);
+                freq_attr_open(&freq_attrs[i * FREQ_NATTRS + j], path);
+            }
+            if (j == FREQ_CORE_THROTTLE) {
+                for (i = 0; i < freq_npackages; i++) {
+                    snprintf(name, sizeof (name), "cpu%u",
+                             freq_packages[i].cpu);
+                    freq_path(path, sizeof (path), SYSFS_CPU_PATH, name,
+                              FREQ_PACKAGE_FILE);
+                    freq_attr_open(&freq_packages[i].attr, path);
+                }
+            }
+        }
+    }
+    
+    dir = opendir(SYSFS_THERMAL_PATH);
+    if (dir) {
+        capacity = 0;
+        while ((ent = readdir(dir)) != NULL) {
+            libsstats_thermal *zones;
+            freq_attr *attrs, attr;
+            int fd;
+            
+            if (strncmp(ent->d_name, "thermal_zone", 12) != 0)
+                continue;
+            
+            freq_path(path, sizeof (path), SYSFS_THERMAL_PATH, ent->d_name,
+                      "temp");
+            freq_attr_open(&attr, path);
+            if (attr.state == FREQ_ABSENT)
+                continue;
+            
+            if (freq_nzones == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                zones = (libsstats_thermal *)realloc(freq_zones,
+                            capacity * sizeof (libsstats_thermal));
+                if (zones)
+                    freq_zones = zones;
+                attrs = (freq_attr *)realloc(freq_zone_attrs,
+                            capacity * sizeof (freq_attr));
+                if (attrs)
+                    freq_zone_attrs = attrs;
+                if (zones == NULL || attrs == NULL) {
+                    freq_attr_close(&attr);
+                    break;
+                }
+            }
+            
+            memset (&freq_zones[freq_nzones], 0, sizeof (libsstats_thermal));
+            freq_zone_attrs[freq_nzones] = attr;
+            
+            /* The zone type never changes; read it once. */
+            freq_path(path, sizeof (path), SYSFS_THERMAL_PATH, ent->d_name,
+                      "type");
+            fd = open(path, O_RDONLY);
+            if (fd >= 0) {
+                ssize_t n = read(fd, freq_zones[freq_nzones].type,
+                                 LIBSSTATS_MAX_THERMALNAMELEN - 1);
+                if (n > 0 && freq_zones[freq_nzones].type[n - 1] == '\n')
+                    freq_zones[freq_nzones].type[n - 1] = '\0';
+                close(fd);
+            }
+            freq_nzones++;
+        }
+        closedir(dir);
+    }
+}
+
+static void
+freq_sample(libsstats_cpufreq *buf)
+{
+    char mask[sizeof (freq_mask)];
+    uint32_t i;
+    
+    if (freq_scanned) {
+        freq_read_mask(mask, sizeof (mask));
+        if (strcmp(mask, freq_mask) != 0)
+            freq_scanned = 0;
+    }
+    if (!freq_scanned) {
+        freq_scan();
+    }
+    
+    for (i = 0; i < freq_npackages; i++)
+        freq_packages[i].count = freq_attr_count(&freq_packages[i].attr);
+    
+    for (i = 0; i < freq_ncpu; i++) {
+        libsstats_corefreq *core = &freq_cores[i];
+        freq_attr *attrs = &freq_attrs[i * FREQ_NATTRS];
+        
+        core->cur_freq            = freq_attr_count(&attrs[FREQ_CUR]);
+        core->min_freq            = freq_attr_count(&attrs[FREQ_MIN]);
+        core->max_freq            = freq_attr_count(&attrs[FREQ_MAX]);
+        core->core_throttle_count
+        = freq_attr_count(&attrs[FREQ_CORE_THROTTLE]);
+        core->package_throttle_count
+        = freq_packages[freq_core_package[i]].count;
+    }
+    
+    for (i = 0; i < freq_nzones; i++) {
+        int64_t temp;
+        
+        freq_zones[i].temp
+        = freq_attr_read(&freq_zone_attrs[i], &temp) == 0 ? temp : 0;
+    }
+    
+    buf->ncpu   = freq_ncpu;
+    buf->cores  = freq_cores;
+    buf->nzones = freq_nzones;
+    buf->zones  = freq_zones;
+}
+
+#else /* __linux__ */
+
+/* kOSThermalNotificationPressureLevelName; the state is the level. */
+#define FREQ_THERMAL_PRESSURE   "com.apple.system.thermalpressurelevel"
+
+static uint32_t           freq_ncpu = 0;
+static uint32_t           freq_capacity = 0;
+static libsstats_corefreq *freq_cores = NULL;
+static int                freq_notify_token;
+static int                freq_notify_registered = 0;
+
+/* In kHz, or 0 where the sysctl doesn't exist (iOS, Apple silicon). */
+static uint64_t
+freq_sysctl_khz(const char *name)
+{
+    uint64_t hz = 0;
+    size_t size = sizeof (hz);
+    
+    if (sysctlbyname(name, &hz, &size, NULL, 0) != 0)
+        return 0;
+    return hz / 1000;
+}
+
+static void
+freq_sample(libsstats_cpufreq *buf)
+{
+    int mib[] = { CTL_HW, HW_NCPU };
+    int ncpu = 0;
+    size_t size = sizeof (ncpu);
+    uint64_t cur, min, max, level;
+    uint32_t i;
+    
+    if (sysctl(mib, 2, &ncpu, &size, NULL, 0) < 0 || ncpu < 1)
+        return;
+    
+    if ((uint32_t)ncpu > freq_capacity) {
+        libsstats_corefreq *cores = (libsstats_corefreq *)realloc(freq_cores,
+                                        ncpu * sizeof (libsstats_corefreq));
+        if (cores == NULL) {
+            syslog(1, "libsysstats: Error: realloc failed.");
+            return;
+        }
+        freq_cores = cores;
+        freq_capacity = ncpu;
+    }
+    freq_ncpu = ncpu;
+    
+    /* The kernel only knows one nominal clock for all cores. */
+    cur = freq_sysctl_khz("hw.cpufrequency");
+    min = freq_sysctl_khz("hw.cpufrequency_min");
+    max = freq_sysctl_khz("hw.cpufrequency_max");
+    
+    for (i = 0; i < freq_ncpu; i++) {
+        memset (&freq_cores[i], 0, sizeof (libsstats_corefreq));
+        freq_cores[i].cpu      = i;
+        freq_cores[i].cur_freq = cur;
+        freq_cores[i].min_freq = min;
+        freq_cores[i].max_freq = max;
+    }
+    
+    /* The thermal pressure level is what tells that the cores are being
+     * slowed down, on iOS as well as on the Mac. */
+    if (!freq_notify_registered
+        && notify_register_check(FREQ_THERMAL_PRESSURE,
+                                 &freq_notify_token) == NOTIFY_STATUS_OK)
+        freq_notify_registered = 1;
+    if (freq_notify_registered
+        && notify_get_state(freq_notify_token, &level) == NOTIFY_STATUS_OK)
+        buf->thermal_level = (uint32_t)level;
+    
+    buf->ncpu  = freq_ncpu;
+    buf->cores = freq_cores;
+}
+
+#endif /* __linux__ */
+
+void
+libsstats_get_cpufreq(libsstats_cpufreq *buf)
+{
+    memset (buf, 0, sizeof (libsstats_cpufreq));
+    
+    freq_sample(buf);
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark Interrupts
+// -----------------------------------------------------------------------------
+
+/* Darwin has no per-IRQ counters outside the kernel debugger, so there is
+ * nothing to read there and both getters return an empty table. */
+#ifdef __linux__
+
+#define PROC_INTERRUPTS_PATH    "/proc/interrupts"
+#define PROC_SOFTIRQS_PATH      "/proc/softirqs"
+
+/* Parser state kept between samples of one matrix file. The header line
+ * and the row labels of the previous sample are remembered so that a
+ * following sample with the same layout only has to scan the counters. */
+typedef struct {
+    const char      *path;
+    int             fd;
+    char            *text;
+    size_t          text_size;
+    char            *header;
+    size_t          header_len;
+    uint32_t        ncpu;
+    uint32_t        number;
+    uint32_t        capacity;
+    libsstats_irq   *irqs;
+    uint64_t        *prev;
+    uint32_t        *tail_hash;
+    uint64_t        *xcpu_total;
+    uint64_t        *xcpu_prev;
+    double          *xcpu_rate;
+    struct timeval  stamp;
+} irq_table;
+
+static irq_table interrupts_table = { PROC_INTERRUPTS_PATH, -1 };
+static irq_table softirqs_table   = { PROC_SOFTIRQS_PATH,   -1 };
+
+/* Reads the whole file into tbl->text, growing the buffer as needed.
+ * The descriptor stays open and is rewound with pread() on every call. */
+static ssize_t
+irq_read_file(irq_table *tbl)
+{
+    size_t len = 0;
+    ssize_t n;
+    
+    if (tbl->fd < 0) {
+        tbl->fd = open(tbl->path, O_RDONLY);
+        if (tbl->fd < 0)
+            return -1;
+    }
+    
+    if (tbl->text == NULL) {
+        tbl->text_size = 64 * 1024;
+        tbl->text = (char *)malloc(tbl->text_size);
+        if (tbl->text == NULL)
+            return -1;
+    }
+    
+    for (;;) {
+        if (len + 1 >= tbl->text_size) {
+            char *newtext = (char *)realloc(tbl->text, tbl->text_size * 2);
+            if (newtext == NULL)
+                return -1;
+            tbl->text = newtext;
+            tbl->text_size *= 2;
+        }
+        
+        n = pread(tbl->fd, tbl->text + len, tbl->text_size - len - 1, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        len += n;
+    }
+    
+    tbl->text[len] = '\0';
+    return len;
+}
+
+/* (Re)allocates the per-row and per-CPU arrays for a new layout. */
+static int
+irq_resize(irq_table *tbl, uint32_t ncpu, uint32_t capacity)
+{
+    uint64_t *counts, *prev, *xcpu_total, *xcpu_prev;
+    double *rates, *xcpu_rate;
+    libsstats_irq *irqs;
+    uint32_t *tail_hash;
+    uint32_t i;
+    
+    irqs       = (libsstats_irq *)calloc(capacity, sizeof (libsstats_irq));
+    counts     = (uint64_t *)calloc((size_t)capacity * ncpu, sizeof (uint64_t));
+    prev       = (uint64_t *)calloc((size_t)capacity * ncpu, sizeof (uint64_t));
+    rates      = (double *)calloc((size_t)capacity * ncpu, sizeof (double));
+    tail_hash  = (uint32_t *)calloc(capacity, sizeof (uint32_t));
+    xcpu_total = (uint64_t *)calloc(ncpu, sizeof (uint64_t));
+    xcpu_prev  = (uint64_t *)calloc(ncpu, sizeof (uint64_t));
+    xcpu_rate  = (double *)calloc(ncpu, sizeof (double));
+    
+    if (!irqs || !counts || !prev || !rates || !tail_hash
+        || !xcpu_total || !xcpu_prev || !xcpu_rate) {
+        free(irqs); free(counts); free(prev); free(rates); free(tail_hash);
+        free(xcpu_total); free(xcpu_prev); free(xcpu_rate);
+        syslog(1, "libsysstats: Error: calloc failed.");
+        return -1;
+    }
+    
+    for (i = 0; i < capacity; i++) {
+        irqs[i].xcpu_count = counts + (size_t)i * ncpu;
+        irqs[i].xcpu_rate  = rates  + (size_t)i * ncpu;
+    }
+    
+    if (tbl->irqs) {
+        free(tbl->irqs[0].xcpu_count);
+        free(tbl->irqs[0].xcpu_rate);
+        free(tbl->irqs);
+    }
+    free(tbl->prev);
+    free(tbl->tail_hash);
+    free(tbl->xcpu_total);
+    free(tbl->xcpu_prev);
+    free(tbl->xcpu_rate);
+    
+    tbl->irqs       = irqs;
+    tbl->prev       = prev;
+    tbl->tail_hash  = tail_hash;
+    tbl->xcpu_total = xcpu_total;
+    tbl->xcpu_prev  = xcpu_prev;
+    tbl->xcpu_rate  = xcpu_rate;
+    tbl->ncpu       = ncpu;
+    tbl->capacity   = capacity;
+    tbl->number     = 0;
+    timerclear(&tbl->stamp);
+    
+    return 0;
+}
+
+/* FNV-1a of the text after the counters, so a row whose handler changed
+ * under the same IRQ number is noticed without keeping a copy of it. */
+static uint32_t
+irq_tail_hash(const char *p, const char *end)
+{
+    uint32_t h = 2166136261u;
+    
+    while (p < end)
+        h = (h ^ (unsigned char)*p++) * 16777619u;
+    return h;
+}
+
+static void
+irq_sample(irq_table *tbl, libsstats_interrupts *buf)
+{
+    char *p, *eol, *label;
+    size_t label_len, header_len;
+    uint32_t ncpu, nlines, row, i;
+    struct timeval now;
+    double dt = 0;
+    int same_layout;
+    
+    memset (buf, 0, sizeof (libsstats_interrupts));
+    
+    if (irq_read_file(tbl) <= 0)
+        return;
+    
+    gettimeofday(&now, NULL);
+    
+    /* Header: "CPU0 CPU1 ..." (offline CPUs are left out). */
+    p = tbl->text;
+    eol = strchr(p, '\n');
+    if (eol == NULL)
+        return;
+    header_len = eol - p;
+    
+    same_layout = (tbl->header != NULL
+                   && tbl->header_len == header_len
+                   && memcmp(tbl->header, p, header_len) == 0);
+    
+    if (!same_layout) {
+        char *header = (char *)malloc(header_len);
+        if (header == NULL)
+            return;
+        memcpy(header, p, header_len);
+        free(tbl->header);
+        tbl->header = header;
+        tbl->header_len = header_len;
+        
+        ncpu = 0;
+        for (label = p; label < eol; label++) {
+            if (strncmp(label, "CPU", 3) == 0) {
+                ncpu++;
+                label += 2;
+            }
+        }
+        
+        nlines = 0;
+        for (label = eol + 1; *label; label++) {
+            if (*label == '\n')
+                nlines++;
+        }
+        
+        if (ncpu == 0 || irq_resize(tbl, ncpu, nlines + 1) < 0) {
+            free(tbl->header);
+            tbl->header = NULL;
+            return;
+        }
+    }
+    
+    ncpu = tbl->ncpu;
+    if (timerisset(&tbl->stamp)) {
+        dt = (now.tv_sec - tbl->stamp.tv_sec)
+           + (now.tv_usec - tbl->stamp.tv_usec) / 1000000.0;
+    }
+    
+    memset (tbl->xcpu_total, 0, ncpu * sizeof (uint64_t));
+    
+    row = 0;
+    for (p = eol + 1; *p; p = eol + 1) {
+        libsstats_irq *irq;
+        uint64_t *count, *prev;
+        char *desc, *end;
+        uint32_t hash;
+        int fresh = 0;
+        
+        eol = strchr(p, '\n');
+        if (eol == NULL)
+            eol = p + strlen(p);
+        
+        while (*p == ' ')
+            p++;
+        label = p;
+        while (p < eol && *p != ':')
+            p++;
+        if (p == eol) {
+            if (*eol == '\0')
+                break;
+            continue;
+        }
+        label_len = p - label;
+        p++;
+        
+        if (row == tbl->capacity) {
+            /* More rows than in the previous layout: start over. */
+            free(tbl->header);
+            tbl->header = NULL;
+            irq_sample(tbl, buf);
+            return;
+        }
+        
+        irq = &tbl->irqs[row];
+        count = irq->xcpu_count;
+        prev = tbl->prev + (size_t)row * ncpu;
+        
+        /* Only rows whose label moved need their name and description
+         * parsed again; everything else just gets new counters. */
+        if (row >= tbl->number
+            || strncmp(irq->name, label, label_len) != 0
+            || irq->name[label_len < LIBSSTATS_MAX_IRQNAMELEN
+                         ? label_len : LIBSSTATS_MAX_IRQNAMELEN - 1] != '\0') {
+            size_t n = label_len < LIBSSTATS_MAX_IRQNAMELEN - 1
+                     ? label_len : LIBSSTATS_MAX_IRQNAMELEN - 1;
+            memcpy(irq->name, label, n);
+            irq->name[n] = '\0';
+            irq->desc[0] = '\0';
+            irq->action[0] = '\0';
+            memset (prev, 0, ncpu * sizeof (uint64_t));
+            memset (irq->xcpu_rate, 0, ncpu * sizeof (double));
+            irq->total = 0;
+            irq->rate = 0;
+            same_layout = 0;
+            fresh = 1;
+        }
+        
+        irq->total = 0;
+        for (i = 0; i < ncpu; i++) {
+            uint64_t v = 0;
+            
+            while (*p == ' ')
+                p++;
+            if (*p < '0' || *p > '9')
+                break;
+            while (*p >= '0' && *p <= '9')
+                v = v * 10 + (*p++ - '0');
+            
+            count[i] = v;
+            irq->total += v;
+            tbl->xcpu_total[i] += v;
+        }
+        /* ERR: and MIS: carry a single system-wide counter. */
+        for (; i < ncpu; i++)
+            count[i] = 0;
+        
+        /* A driver reload can hand the same IRQ number to another
+         * handler, so the description is parsed again whenever the tail
+         * of the row differs from the previous sample. */
+        while (*p == ' ')
+            p++;
+        desc = p;
+        end = eol;
+        while (end > desc && (end[-1] == ' ' || end[-1] == '\r'))
+            end--;
+        hash = irq_tail_hash(desc, end);
+        
+        if (fresh || hash != tbl->tail_hash[row]) {
+            tbl->tail_hash[row] = hash;
+            irq->desc[0] = '\0';
+            irq->action[0] = '\0';
+            if (end > desc) {
+                size_t n = end - desc;
+                if (n > LIBSSTATS_MAX_IRQDESCLEN - 1)
+                    n = LIBSSTATS_MAX_IRQDESCLEN - 1;
+                memcpy(irq->desc, desc, n);
+                irq->desc[n] = '\0';
+                
+                /* "IR-PCI-MSIX-0000:3b:00.0 0-edge mlx5_comp0@pci:..." */
+                if (irq->name[0] >= '0' && irq->name[0] <= '9') {
+                    char *action = end;
+                    
+                    while (action > desc && action[-1] != ' ')
+                        action--;
+                    n = end - action;
+                    if (n > LIBSSTATS_MAX_IRQACTIONLEN - 1)
+                        n = LIBSSTATS_MAX_IRQACTIONLEN - 1;
+                    memcpy(irq->action, action, n);
+                    irq->action[n] = '\0';
+                }
+            }
+        }
+        
+        if (dt > 0 && !fresh) {
+            irq->rate = 0;
+            for (i = 0; i < ncpu; i++) {
+                irq->xcpu_rate[i] = count[i] >= prev[i]
+                                  ? (count[i] - prev[i]) / dt : 0;
+                irq->rate += irq->xcpu_rate[i];
+            }
+        }
+        memcpy(prev, count, ncpu * sizeof (uint64_t));
+        
+        buf->total += irq->total;
+        row++;
+        
+        if (*eol == '\0')
+            break;
+    }
+    
+    if (row != tbl->number)
+        same_layout = 0;
+    tbl->number = row;
+    
+    for (i = 0; i < ncpu; i++) {
+        if (same_layout && dt > 0) {
+            tbl->xcpu_rate[i] = tbl->xcpu_total[i] >= tbl->xcpu_prev[i]
+                              ? (tbl->xcpu_total[i] - tbl->xcpu_prev[i]) / dt
+                              : 0;
+            buf->rate += tbl->xcpu_rate[i];
+        }
+        else {
+            tbl->xcpu_rate[i] = 0;
+        }
+        tbl->xcpu_prev[i] = tbl->xcpu_total[i];
+    }
+    tbl->stamp = now;
+    
+    buf->number     = tbl->number;
+    buf->ncpu       = ncpu;
+    buf->irqs       = tbl->irqs;
+    buf->xcpu_total = tbl->xcpu_total;
+    buf->xcpu_rate  = tbl->xcpu_rate;
+}
+
+#endif /* __linux__ */
+
+void
+libsstats_get_interrupts(libsstats_interrupts *buf)
+{
+#ifdef __linux__
+    irq_sample(&interrupts_table, buf);
+#else
+    memset (buf, 0, sizeof (libsstats_interrupts));
+#endif
+}
+
+void
+libsstats_get_softirqs(libsstats_interrupts *buf)
+{
+#ifdef __linux__
+    irq_sample(&softirqs_table, buf);
+#else
+    memset (buf, 0, sizeof (libsstats_interrupts));
+#endif
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark Net
+// -----------------------------------------------------------------------------
+
+char **
+libsstats_get_netlist(libsstats_netlist *buf)
+{
+    struct if_nameindex *ifstart, *ifs;
+    static char *devices[LIBSSTATS_MAX_NETDEVICES];
+    
+    memset (buf, 0, sizeof (libsstats_netlist));
+    
+    ifs = ifstart = if_nameindex();
+    while(ifs && ifs->if_name) {
+        devices[buf->number] = ifs->if_name;
+        buf->number++;
+        ifs++;
+    }
+    
+    return (char **)devices;
+}
+
+
+static void
+netload_fill(libsstats_netload *buf, const struct if_msghdr *ifm)
+{
+	if (ifm->ifm_flags & IFF_UP)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_UP;
+	if (ifm->ifm_flags & IFF_BROADCAST)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_BROADCAST;
+	if (ifm->ifm_flags & IFF_DEBUG)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_DEBUG;
+	if (ifm->ifm_flags & IFF_LOOPBACK)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_LOOPBACK;
+	if (ifm->ifm_flags & IFF_POINTOPOINT)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_POINTOPOINT;
+	if (ifm->ifm_flags & IFF_RUNNING)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_RUNNING;
+	if (ifm->ifm_flags & IFF_NOARP)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_NOARP;
+	if (ifm->ifm_flags & IFF_NOARP)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_PROMISC;
+	if (ifm->ifm_flags & IFF_ALLMULTI)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_ALLMULTI;
+	if (ifm->ifm_flags & IFF_OACTIVE)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_OACTIVE;
+	if (ifm->ifm_flags & IFF_SIMPLEX)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_SIMPLEX;
+	if (ifm->ifm_flags & IFF_LINK0)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_LINK0;
+	if (ifm->ifm_flags & IFF_LINK1)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_LINK1;
+	if (ifm->ifm_flags & IFF_LINK2)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_LINK2;
+	if (ifm->ifm_flags & IFF_ALTPHYS)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_ALTPHYS;
+	if (ifm->ifm_flags & IFF_MULTICAST)
+		buf->if_flags |= LIBSSTATS_IF_FLAGS_MULTICAST;
+	buf->mtu            = ifm->ifm_data.ifi_mtu;
+	buf->subnet         = 0; /* FIXME */
+	buf->address		= 0; /* FIXME */
+	buf->packets_in		= ifm->ifm_data.ifi_ipackets;
+	buf->packets_out	= ifm->ifm_data.ifi_opackets;
+	buf->packets_total	= buf->packets_in + buf->packets_out;
+	buf->bytes_in		= ifm->ifm_data.ifi_ibytes;
+	buf->bytes_out		= ifm->ifm_data.ifi_obytes;
+	buf->bytes_total	= buf->bytes_in + buf->bytes_out;
+	buf->errors_in		= ifm->ifm_data.ifi_ierrors;
+	buf->errors_out		= ifm->ifm_data.ifi_oerrors;
+	buf->errors_total	= buf->errors_in + buf->errors_out;
+	buf->collisions		= ifm->ifm_data.ifi_collisions;
+}
+
+void libsstats_get_netload(libsstats_netload *buf, const char *intf)
+{
+	int mib[] = { CTL_NET, PF_ROUTE, 0, 0, NET_RT_IFLIST, 0 };
+    size_t bufsize;
+	char *rtbuf, *ptr, *eob;
+	struct if_msghdr *ifm;
+        
+	memset(buf, 0, sizeof (libsstats_netload));
+	if (sysctl(mib, 6, NULL, &bufsize, NULL, 0) < 0)
+		return;
+    
+	rtbuf = (char *)malloc(bufsize);
+	if (rtbuf == NULL)
+		return;
+    
+	if (sysctl(mib, 6, rtbuf, &bufsize, NULL, 0) < 0) {
+		free(rtbuf);
+		return;
+	}
+    
+	eob = rtbuf + bufsize;
+	ptr = rtbuf;
+	while (ptr < eob) {
+		struct sockaddr_dl *sdl;
+        
+		ifm = (struct if_msghdr *)ptr;
+        
+		if (ifm->ifm_type != RTM_IFINFO)
+			break;
+		ptr += ifm->ifm_msglen;
+        
+		while (ptr < eob) {
+			struct if_msghdr *nextifm = (struct if_msghdr *)ptr;
+            
+			if (nextifm->ifm_type != RTM_NEWADDR)
+				break;
+			ptr += nextifm->ifm_msglen;
+		}
+        
+		sdl = (struct sockaddr_dl *)(ifm + 1);
+        if (sdl->sdl_family != AF_LINK)
+			continue;
+		
+        if (strlen(intf) != sdl->sdl_nlen)
+			continue;
+
+        if (strncmp(intf, "en", 2) == 0)
+        {
+            if (strncmp(intf, sdl->sdl_data, 3) == 0)
+                goto FOUND;
+        }
+        else
+        {
+            if (strcmp(intf, sdl->sdl_data) == 0) // TODO
+			goto FOUND;
+        }
+	}
+	free (rtbuf);
+	return;
+    
+FOUND:
+	netload_fill(buf, ifm);
+	free (rtbuf);
+}
+
+void
+libsstats_get_mac(const char *intf, libsstats_mac *buf)
+{
+    int success;
+    struct ifaddrs *addrs;
+    struct ifaddrs *cursor;
+    const struct sockaddr_dl *sock_addr;
+    const unsigned char *base;
+    int i;
+    
+    memset (buf, 0, sizeof (libsstats_mac));
+    
+    success = (getifaddrs(&addrs) == 0);
+    if (!success) {
+        return;
+    }
+    
+    cursor = addrs;
+    while (cursor != 0) {
+        if ((cursor->ifa_addr->sa_family == AF_LINK)
+            && (((const struct sockaddr_dl *)cursor->ifa_addr)->sdl_type == IFT_ETHER)
+            && strcmp(intf,  cursor->ifa_name) == 0) {
+            sock_addr = (const struct sockaddr_dl *)cursor->ifa_addr;
+            base = (const unsigned char *)&sock_addr->sdl_data[sock_addr->sdl_nlen];
+            strcpy(buf->macaddress, ""); 
+            for (i = 0; i < sock_addr->sdl_alen; i++) {
+                if (i != 0) {
+                    strcat(buf->macaddress, ":");
+                }
+                char partialAddr[3];
+                sprintf(partialAddr, "%02x", base[i]);  // TODO
+                strcat(buf->macaddress, partialAddr);   // TODO
+            }
+        }
+        cursor = cursor->ifa_next;
+    }
+    
+    freeifaddrs(addrs);
+}
+
+void
+libsstats_get_ip(const char *intf, libsstats_ip *buf)
+{
+    struct ifaddrs *interfaces = NULL;
+    struct ifaddrs *temp_addr = NULL;
+    int success = 0;
+    
+    memset (buf, 0, sizeof (libsstats_ip));
+
+    strncpy(buf->ipaddress, "N/A", 4);
+    
+    success = getifaddrs(&interfaces);
+    if (success == 0)
+    {
+        temp_addr = interfaces;
+        while(temp_addr != NULL)
+        {
+            if(temp_addr->ifa_addr->sa_family == AF_INET)
+            {
+                if (strcmp(temp_addr->ifa_name, intf) == 0) // TODO
+                {
+                    strcpy(buf->ipaddress,
+                           inet_ntoa(((struct sockaddr_in *)temp_addr->ifa_addr)->sin_addr)); // TODO
+                }
+            }
+            
+            temp_addr = temp_addr->ifa_next;
+        }
+    }
+    
+    freeifaddrs(interfaces);
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark Sockets
+// -----------------------------------------------------------------------------
+
+#define XSO_SOCKET              0x001
+#define XSO_RCVBUF              0x002
+#define XSO_SNDBUF              0x004
+#define XSO_STATS               0x008
+#define XSO_INPCB               0x010
+#define XSO_TCPCB               0x020
+
+#define SOCK_KINDS_UDP \
+    (XSO_SOCKET | XSO_RCVBUF | XSO_SNDBUF | XSO_STATS | XSO_INPCB)
+#define SOCK_KINDS_TCP          (SOCK_KINDS_UDP | XSO_TCPCB)
+
+#define SOCK_INP_IPV4           0x1
+#define SOCK_INP_IPV6           0x2
+
+#define SOCK_ROUNDUP64(n)       (((n) + 7) & ~(size_t)7)
+
+/* Leading fields of the private pcblist_n records (netinet/in_pcb.h and
+ * netinet/tcp_var.h in xnu), which aren't in the iOS SDK. Every record
+ * starts with its length and kind, so only the fields read here need to
+ * match. */
+typedef struct {
+    uint32_t        xig_len;
+    uint32_t        xig_count;
+    uint64_t        xig_gen;
+    uint64_t        xig_sogen;
+} sock_xinpgen;
+
+typedef struct {
+    uint32_t        xgn_len;
+    uint32_t        xgn_kind;
+} sock_xgen;
+
+typedef struct {
+    uint32_t        xi_len;
+    uint32_t        xi_kind;
+    uint64_t        xi_inpp;
+    uint16_t        inp_fport;
+    uint16_t        inp_lport;
+    uint64_t        inp_ppcb;
+    uint64_t        inp_gencnt;
+    int32_t         inp_flags;
+    uint32_t        inp_flow;
+    uint8_t         inp_vflag;
+    uint8_t         inp_ip_ttl;
+    uint8_t         inp_ip_p;
+    struct in6_addr inp_faddr;  /* IPv4 in the last four bytes */
+    struct in6_addr inp_laddr;
+} sock_xinpcb;
+
+typedef struct {
+    uint32_t        xt_len;
+    uint32_t        xt_kind;
+    uint64_t        t_segq;
+    int32_t         t_dupacks;
+    int32_t         t_timer[4];
+    int32_t         t_state;
+} sock_xtcpcb;
+
+/* Connections are aggregated while the PCB list is walked, so apart from
+ * the sysctl snapshot itself memory only depends on the number of
+ * distinct ports and peers. Ports index a flat array; peers go into an
+ * open addressing hash table that is kept between calls. */
+typedef struct {
+    uint8_t  address6[16];
+    uint64_t count;
+} sock_peer;
+
+static uint64_t   sock_ports[65536];
+static sock_peer *sock_peers = NULL;
+static uint32_t   sock_peers_size = 0;
+static uint32_t   sock_peers_number = 0;
+
+static uint32_t
+sock_peer_hash(const uint8_t *address6)
+{
+    uint32_t h = 2166136261u;
+    int i;
+    
+    for (i = 0; i < 16; i++)
+        h = (h ^ address6[i]) * 16777619u;
+    return h;
+}
+
+static int
+sock_peer_grow(void)
+{
+    uint32_t size = sock_peers_size ? sock_peers_size * 2 : 1024;
+    sock_peer *peers, *old = sock_peers;
+    uint32_t i;
+    
+    peers = (sock_peer *)calloc(size, sizeof (sock_peer));
+    if (peers == NULL) {
+        syslog(1, "libsysstats: Error: calloc failed.");
+        return -1;
+    }
+    
+    for (i = 0; i < sock_peers_size; i++) {
+        uint32_t j;
+        
+        if (old[i].count == 0)
+            continue;
+        j = sock_peer_hash(old[i].address6) & (size - 1);
+        while (peers[j].count)
+            j = (j + 1) & (size - 1);
+        peers[j] = old[i];
+    }
+    
+    free(old);
+    sock_peers = peers;
+    sock_peers_size = size;
+    return 0;
+}
+
+static void
+sock_peer_add(const uint8_t *address6)
+{
+    uint32_t j;
+    
+    if (sock_peers_number * 2 >= sock_peers_size && sock_peer_grow() < 0)
+        return;
+    
+    j = sock_peer_hash(address6) & (sock_peers_size - 1);
+    while (sock_peers[j].count) {
+        if (memcmp(sock_peers[j].address6, address6, 16) == 0) {
+            sock_peers[j].count++;
+            return;
+        }
+        j = (j + 1) & (sock_peers_size - 1);
+    }
+    
+    memcpy(sock_peers[j].address6, address6, 16);
+    sock_peers[j].count = 1;
+    sock_peers_number++;
+}
+
+/* Walks one pcblist_n snapshot. The kernel emits a sock_xinpgen, then a
+ * run of tagged records per socket, then a closing sock_xinpgen. */
+static void
+sock_walk(libsstats_sockets *buf, const char *name, int tcp)
+{
+    static char *list = NULL;
+    static size_t list_size = 0;
+    const sock_xinpcb *inp = NULL;
+    const sock_xtcpcb *tp = NULL;
+    const sock_xinpgen *xig;
+    char *next, *end;
+    uint32_t which = 0;
+    size_t len;
+    
+    /* The snapshot buffer only grows, so steady state costs no malloc. */
+    for (;;) {
+        if (sysctlbyname(name, NULL, &len, NULL, 0) < 0)
+            return;
+        len += len / 8;
+        if (len > list_size) {
+            char *newlist = (char *)realloc(list, len);
+            if (newlist == NULL) {
+                syslog(1, "libsysstats: Error: realloc failed.");
+                return;
+            }
+            list = newlist;
+            list_size = len;
+        }
+        len = list_size;
+        if (sysctlbyname(name, list, &len, NULL, 0) == 0)
+            break;
+        if (errno != ENOMEM)
+            return;
+    }
+    
+    if (len < sizeof (sock_xinpgen))
+        return;
+    xig = (const sock_xinpgen *)list;
+    end = list + len;
+    
+    for (next = list + SOCK_ROUNDUP64(xig->xig_len); next < end;
+         next += SOCK_ROUNDUP64(((sock_xgen *)next)->xgn_len)) {
+        const sock_xgen *xgn = (const sock_xgen *)next;
+        uint8_t remote6[16];
+        uint16_t local_port;
+        
+        if (xgn->xgn_len <= sizeof (sock_xinpgen))
+            break;
+        
+        which |= xgn->xgn_kind;
+        if (xgn->xgn_kind == XSO_INPCB)
+            inp = (const sock_xinpcb *)xgn;
+        else if (xgn->xgn_kind == XSO_TCPCB)
+            tp = (const sock_xtcpcb *)xgn;
+        
+        if (which != (tcp ? SOCK_KINDS_TCP : SOCK_KINDS_UDP))
+            continue;
+        which = 0;
+        
+        /* Sockets created after the snapshot started. */
+        if (inp == NULL || inp->inp_gencnt > xig->xig_gen)
+            continue;
+        
+        if (!tcp) {
+            buf->udp_total++;
+            continue;
+        }
+        
+        buf->tcp_total++;
+        if (tp && tp->t_state >= 0 && tp->t_state < LIBSSTATS_TCP_NSTATES)
+            buf->tcp_states[tp->t_state]++;
+        
+        local_port = ntohs(inp->inp_lport);
+        sock_ports[local_port]++;
+        
+        if (inp->inp_fport == 0)
+            continue;
+        if (inp->inp_vflag & SOCK_INP_IPV6) {
+            memcpy(remote6, &inp->inp_faddr, 16);
+        }
+        else {
+            memset (remote6, 0, 10);
+            remote6[10] = remote6[11] = 0xff;
+            memcpy(remote6 + 12, (const uint8_t *)&inp->inp_faddr + 12, 4);
+        }
+        sock_peer_add(remote6);
+    }
+}
+
+void
+libsstats_get_sockets(libsstats_sockets *buf)
+{
+    uint32_t i, j;
+    
+    memset (buf, 0, sizeof (libsstats_sockets));
+    memset (sock_ports, 0, sizeof (sock_ports));
+    if (sock_peers) {
+        memset (sock_peers, 0, sock_peers_size * sizeof (sock_peer));
+    }
+    sock_peers_number = 0;
+    
+    sock_walk(buf, "net.inet.tcp.pcblist_n", 1);
+    sock_walk(buf, "net.inet.udp.pcblist_n", 0);
+    
+    /* Keep the busiest local ports and remote peers, sorted by count. */
+    for (i = 0; i < 65536; i++) {
+        uint64_t count = sock_ports[i];
+        
+        if (count == 0)
+            continue;
+        if (buf->nports == LIBSSTATS_MAX_SOCKPORTS
+            && count <= buf->ports[buf->nports - 1].count)
+            continue;
+        
+        j = buf->nports < LIBSSTATS_MAX_SOCKPORTS ? buf->nports++
+                                                  : buf->nports - 1;
+        for (; j > 0 && buf->ports[j - 1].count < count; j--)
+            buf->ports[j] = buf->ports[j - 1];
+        buf->ports[j].port = (uint16_t)i;
+        buf->ports[j].count = count;
+    }
+    
+    for (i = 0; i < sock_peers_size; i++) {
+        uint64_t count = sock_peers[i].count;
+        
+        if (count == 0)
+            continue;
+        if (buf->npeers == LIBSSTATS_MAX_SOCKPEERS
+            && count <= buf->peers[buf->npeers - 1].count)
+            continue;
+        
+        j = buf->npeers < LIBSSTATS_MAX_SOCKPEERS ? buf->npeers++
+                                                  : buf->npeers - 1;
+        for (; j > 0 && buf->peers[j - 1].count < count; j--)
+            buf->peers[j] = buf->peers[j - 1];
+        memcpy(buf->peers[j].address6, sock_peers[i].address6, 16);
+        buf->peers[j].count = count;
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark Memory
+// -----------------------------------------------------------------------------
+
+void
+libsstats_get_mem(libsstats_mem *buf)
+{
+	vm_statistics_data_t vm_info;
+	mach_msg_type_number_t info_count;
+        
+	memset (buf, 0, sizeof (libsstats_mem));
+    
+	info_count = HOST_VM_INFO_COUNT;
+	if (host_statistics(mach_host_self(), HOST_VM_INFO,
+                         (host_info_t)&vm_info, &info_count)) {
+		return;
+	}
+    
+    float active_count   = vm_info.active_count   * vm_page_size / 1048576.0;
+    float inactive_count = vm_info.inactive_count * vm_page_size / 1048576.0;
+    float wire_count     = vm_info.wire_count     * vm_page_size / 1048576.0;
+    float total_count    = (vm_info.active_count
+                         +  vm_info.inactive_count
+                         +  vm_info.free_count
+                         +  vm_info.wire_count)    * vm_page_size / 1048576.0;
+    float free_count     = vm_info.free_count      * vm_page_size / 1048576.0;
+    float used_count     = total_count - free_count               / 1048576.0;
+    buf->active             = active_count;
+    buf->inactive           = inactive_count;
+    buf->wired              = wire_count;
+    buf->total              = total_count;
+    buf->free               = free_count;
+    buf->used               = used_count;
+}
+
+
+// -----------------------------------------------------------------------------
+#pragma mark Wireless
 // -----------------------------------------------------------------------------
 
 static int curr_scanning = 0;
 
-void
-libsstats_get_wireless(libsstats_wireless *buf)
+void
+libsstats_get_wireless(libsstats_wireless *buf)
+{
+    if (curr_scanning)
+    {
+        return;
+    }
+    curr_scanning = 1;
+
+    memset (buf, 0, sizeof (libsstats_wireless));
+   
+    typedef int (*open_h)(void *);
+    typedef int (*close_h)(void *);
+    typedef int (*bind_h)(void *, CFStringRef);
+    typedef int (*scan_h)(void *, CFArrayRef *, void *);
+
+    open_h o;
+    close_h c;
+    bind_h b;
+    scan_h s;
+    
+    void *handle = dlopen(IPCONFIGURATION_BUNDLE_PATH, RTLD_LAZY);
+    if (!handle) goto DONE;
+    
+    *(void **)(&o) = dlsym(handle, "Apple80211Open");
+    if (!o) goto DONE;
+    
+    *(void **)(&c) = dlsym(handle, "Apple80211Close");
+    if (!c) goto DONE;
+    
+    *(void **)(&b) = dlsym(handle, "Apple80211BindToInterface");
+    if (!b) goto DONE;
+    
+    *(void **)(&s) = dlsym(handle, "Apple80211Scan");
+    if (!s) goto DONE;
+    
+    CFDictionaryRef parameters
+    = CFDictionaryCreateMutable(
+        NULL,
+        0,
+        &kCFTypeDictionaryKeyCallBacks,
+        &kCFTypeDictionaryValueCallBacks
+    );
+    
+    int retval;
+    
+    // Open
+    retval = o(&handle);
+    if (retval) goto DONE;
+    
+    // Bind
+    retval = b(handle, CFSTR("en0"));
+    if (retval) goto DONE;
+    
+    CFArrayRef networks;
+
+    // Scan
+    retval = s(handle, &networks, (void *)parameters);
+    if (retval) goto DONE;
+    
+    // Info
+    int i;
+    for (i = 0; i < CFArrayGetCount(networks) && i < 256; i++) {
+        CFDictionaryRef network
+        = (CFDictionaryRef)CFArrayGetValueAtIndex(networks, i);
+        buf->networks[i] = network;
+        buf->number++;
+    }
+    
+    // Close
+    c(handle);
+    dlclose(handle);    
+    
+DONE:
+    curr_scanning = 0;
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark Cellular Data
+// -----------------------------------------------------------------------------
+
+void
+libsstats_get_cellular(libsstats_cellular *buf)
+{
+    memset (buf, 0, sizeof(libsstats_cellular));
+    void *libHandle = dlopen(CORE_TELEPHONY_PATH, RTLD_LAZY);
+	
+    int (*CTGetSignalStrength)();
+	CTGetSignalStrength = dlsym(libHandle, "CTGetSignalStrength");
+	if (CTGetSignalStrength == NULL) return;	
+	
+    buf->rssi = CTGetSignalStrength();
+	
+    dlclose(libHandle);	
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark Processes
+// -----------------------------------------------------------------------------
+
+/* Returns the kinfo_proc array for the given KERN_PROC mib, or NULL. The
+ * caller frees it. */
+static struct kinfo_proc *
+proc_fetch(int *mib, size_t miblen, int *nprocs)
+{
+    struct kinfo_proc *procs = NULL, *newprocs;
+    size_t size;
+    int st;
+    
+    *nprocs = 0;
+    
+    st = sysctl(mib, miblen, NULL, &size, NULL, 0);
+    if (st != 0 || size == 0) {
+        /* No such pid, or nothing for this uid. */
+        return NULL;
+    }
+    
+    do {
+        size += size / 10;
+        newprocs = realloc(procs, size);
+        if (!newprocs) {
+            if (procs) {
+                free(procs);
+            }
+            
+            syslog(1, "libsysstats: Error: realloc failed.");
+            return NULL;
+        }
+        
+        procs = newprocs;
+        st = sysctl(mib, miblen, procs, &size, NULL, 0);
+    } while (st == -1 && errno == ENOMEM);
+    
+    if (st != 0) {
+        syslog(1, "libsysstats: Error: sysctl(KERN_PROC) failed.");
+        free(procs);
+        return NULL;
+    }
+    
+    if (size % sizeof(struct kinfo_proc) != 0) {
+        free(procs);
+        return NULL;
+    }
+    *nprocs = size / sizeof(struct kinfo_proc);
+    
+    return procs;
+}
+
+static proc_state
+proc_get_state(const struct kinfo_proc *kp)
+{
+    switch (kp->kp_proc.p_stat) {
+    case SIDL:
+        return LIBSSTATS_PROC_IDLE;
+    case SRUN:
+        return LIBSSTATS_PROC_RUN;
+    case SSLEEP:
+        return LIBSSTATS_PROC_SLEEP;
+    case SSTOP:
+        return LIBSSTATS_PROC_STOP;
+    case SZOMB:
+        return LIBSSTATS_PROC_ZOMBIE;
+    default:
+        return LIBSSTATS_PROC_UNKNOWN;
+    }
+}
+
+static void
+proc_add(libsstats_processinfo *buf, const struct kinfo_proc *kp, time_t now)
+{
+    libsstats_process *proc;
+    
+    if (buf->number >= LIBSSTATS_MAX_PROCESSES) {
+        return;
+    }
+    
+    proc = &buf->processes[buf->number];
+    memset (proc, 0, sizeof (libsstats_process));
+    strncpy(proc->name, kp->kp_proc.p_comm, LIBSSTATS_MAX_NAMELEN - 1);
+    proc->pid = (int)kp->kp_proc.p_pid;
+    proc->priority = (u_char)(kp->kp_proc.p_priority);
+    proc->run_time = now - kp->kp_proc.p_starttime.tv_sec;
+    proc->state = proc_get_state(kp);
+    
+    buf->number++;
+}
+
+void libsstats_get_processinfo(libsstats_processinfo *buf)
+{
+    int mib[] = { CTL_KERN, KERN_PROC, KERN_PROC_ALL, 0 };
+    struct kinfo_proc *procs;
+    int i, nprocs;
+    time_t now;
+    
+    memset (buf, 0, sizeof (libsstats_processinfo));
+
+    procs = proc_fetch(mib, 4, &nprocs);
+    if (!procs) {
+        return;
+    }
+    
+    if (!nprocs) {
+        syslog(1, "libsysstats: !nprocs");
+        free(procs);
+        return;
+    }
+
+    time (&now);
+    
+    /* Get all processes. */
+    for (i = nprocs - 1; i >= 0;  i--) {
+        proc_add(buf, &procs[i], now);
+    }
+    
+    free(procs);
+}
+
+/* Checks the predicates of `query' against one process, cheapest first:
+ * plain integer compares before the name match. The pid set isn't checked
+ * here; a query with one only ever fetches the pids in it. */
+static int
+proc_matches(const libsstats_proc_query *query, const struct kinfo_proc *kp,
+             time_t now)
+{
+    const char *name = query->name;
+    
+    if ((query->flags & LIBSSTATS_QUERY_UID)
+        && kp->kp_eproc.e_ucred.cr_uid != query->uid)
+        return 0;
+    
+    if ((query->flags & LIBSSTATS_QUERY_STATE)
+        && proc_get_state(kp) != query->state)
+        return 0;
+    
+    if ((query->flags & LIBSSTATS_QUERY_RUN_TIME)
+        && now - kp->kp_proc.p_starttime.tv_sec < query->min_run_time)
+        return 0;
+    
+    if (query->flags & LIBSSTATS_QUERY_NAME) {
+        /* A name with glob characters is a fnmatch(3) pattern, anything
+         * else a prefix. */
+        if (strpbrk(name, "*?[") != NULL) {
+            if (fnmatch(name, kp->kp_proc.p_comm, 0) != 0)
+                return 0;
+        }
+        else if (strncmp(kp->kp_proc.p_comm, name, strlen(name)) != 0) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+static int
+proc_pid_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    
+    return x < y ? -1 : x > y;
+}
+
+void
+libsstats_query_processinfo(const libsstats_proc_query *query,
+                            libsstats_processinfo *buf)
+{
+    int mib[] = { CTL_KERN, KERN_PROC, KERN_PROC_ALL, 0 };
+    struct kinfo_proc *procs;
+    int i, nprocs;
+    time_t now;
+    
+    memset (buf, 0, sizeof (libsstats_processinfo));
+    
+    time (&now);
+    
+    /* A pid set is looked up pid by pid; the kernel never copies out the
+     * rest of the process table. The set is sorted so that duplicates
+     * are looked up, and reported, once. */
+    if (query->flags & LIBSSTATS_QUERY_PIDS) {
+        uint32_t pids[LIBSSTATS_MAX_PROCESSES];
+        uint32_t j, number = query->number;
+        
+        if (number > LIBSSTATS_MAX_PROCESSES) {
+            number = LIBSSTATS_MAX_PROCESSES;
+        }
+        memcpy(pids, query->pids, number * sizeof (uint32_t));
+        qsort(pids, number, sizeof (uint32_t), proc_pid_compare);
+        
+        mib[2] = KERN_PROC_PID;
+        for (j = 0; j < number; j++) {
+            if (j > 0 && pids[j] == pids[j - 1]) {
+                continue;
+            }
+            mib[3] = (int)pids[j];
+            procs = proc_fetch(mib, 4, &nprocs);
+            if (!procs) {
+                continue;
+            }
+            if (nprocs == 1 && proc_matches(query, &procs[0], now)) {
+                proc_add(buf, &procs[0], now);
+            }
+            free(procs);
+        }
+        return;
+    }
+    
+    /* Let the kernel filter by uid. */
+    if (query->flags & LIBSSTATS_QUERY_UID) {
+        mib[2] = KERN_PROC_UID;
+        mib[3] = (int)query->uid;
+    }
+    
+    procs = proc_fetch(mib, 4, &nprocs);
+    if (!procs) {
+        return;
+    }
+    
+    for (i = nprocs - 1; i >= 0;  i--) {
+        if (proc_matches(query, &procs[i], now)) {
+            proc_add(buf, &procs[i], now);
+        }
+    }
+    
+    free(procs);
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark Process Memory
+// -----------------------------------------------------------------------------
+
+#define PROCMEM_DEFAULT_TTL     10.0
+
+#define PROCMEM_IDLE_TTLS       3
+
+/* proc_pid_rusage() only reads the task's ledger and pmap counters, but
+ * it is still a syscall and a process lookup per pid. The results are
+ * cached per pid so that callers polling many pids pay for at most one
+ * read per pid and TTL, and libsstats_refresh_procmem() can spread the
+ * reads over a budget. Only pids somebody asked for are cached, and only
+ * those asked for recently are refreshed in the background. */
+typedef struct {
+    libsstats_procmem   mem;
+    double              used;
+} procmem_entry;
+
+/* libproc.h isn't part of the iOS SDK. */
+extern int proc_pid_rusage(int pid, int flavor, rusage_info_t *buffer);
+
+static procmem_entry procmem_cache[LIBSSTATS_MAX_PROCESSES];
+static unsigned procmem_number = 0;
+static double procmem_ttl = PROCMEM_DEFAULT_TTL;
+
+static double
+procmem_now(void)
+{
+    struct timeval now;
+    
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+/* Returns -1 if the process is gone or not ours to look at. */
+static int
+procmem_read(uint32_t pid, libsstats_procmem *mem)
+{
+    struct rusage_info_v2 ri;
+    
+    if (proc_pid_rusage((int)pid, RUSAGE_INFO_V2, (rusage_info_t *)&ri) != 0)
+        return -1;
+    
+    memset (mem, 0, sizeof (libsstats_procmem));
+    mem->pid       = pid;
+    mem->rss       = ri.ri_resident_size;
+    mem->footprint = ri.ri_phys_footprint;
+    mem->wired     = ri.ri_wired_size;
+    mem->stamp     = procmem_now();
+    
+    return 0;
+}
+
+static procmem_entry *
+procmem_lookup(uint32_t pid)
+{
+    unsigned i;
+    
+    for (i = 0; i < procmem_number; i++) {
+        if (procmem_cache[i].mem.pid == pid)
+            return &procmem_cache[i];
+    }
+    return NULL;
+}
+
+static void
+procmem_remove(procmem_entry *entry)
+{
+    *entry = procmem_cache[--procmem_number];
+}
+
+void
+libsstats_set_procmem_ttl(double seconds)
+{
+    procmem_ttl = seconds;
+}
+
+void
+libsstats_get_procmem(uint32_t pid, libsstats_procmem *buf)
+{
+    procmem_entry *entry;
+    double now;
+    unsigned i;
+    
+    memset (buf, 0, sizeof (libsstats_procmem));
+    
+    now = procmem_now();
+    entry = procmem_lookup(pid);
+    
+    if (entry == NULL) {
+        if (procmem_number < LIBSSTATS_MAX_PROCESSES) {
+            entry = &procmem_cache[procmem_number++];
+        }
+        else {
+            /* Full: drop the entry nobody asked for the longest. */
+            entry = &procmem_cache[0];
+            for (i = 1; i < procmem_number; i++) {
+                if (procmem_cache[i].used < entry->used)
+                    entry = &procmem_cache[i];
+            }
+        }
+        memset (entry, 0, sizeof (procmem_entry));
+        entry->mem.pid = pid;
+    }
+    entry->used = now;
+    
+    if (entry->mem.stamp == 0 || now - entry->mem.stamp >= procmem_ttl) {
+        if (procmem_read(pid, &entry->mem) < 0) {
+            procmem_remove(entry);
+            return;
+        }
+    }
+    
+    *buf = entry->mem;
+}
+
+/* Re-reads at most `budget' cached entries whose TTL ran out, largest
+ * RSS first. Meant to be called once per refresh tick, so that readers
+ * of libsstats_get_procmem() mostly hit warm entries. Entries nobody
+ * asked for in the last PROCMEM_IDLE_TTLS TTLs are left alone. */
+void
+libsstats_refresh_procmem(unsigned budget)
+{
+    double now = procmem_now();
+    
+    while (budget > 0) {
+        procmem_entry *best = NULL;
+        unsigned i;
+        
+        for (i = 0; i < procmem_number; i++) {
+            procmem_entry *entry = &procmem_cache[i];
+            
+            if (now - entry->mem.stamp < procmem_ttl
+                || now - entry->used > PROCMEM_IDLE_TTLS * procmem_ttl)
+                continue;
+            if (best == NULL || entry->mem.rss > best->mem.rss)
+                best = entry;
+        }
+        if (best == NULL)
+            break;
+        
+        if (procmem_read(best->mem.pid, &best->mem) < 0)
+            procmem_remove(best);
+        budget--;
+    }
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark Uptime
+// -----------------------------------------------------------------------------
+
+void libsstats_get_uptime(libsstats_uptime *buf)
+{
+    int mib[] = { CTL_KERN, KERN_BOOTTIME };
+	struct timeval boottime;
+	size_t size = sizeof (boottime);
+	time_t now;
+    	
+	memset (buf, 0, sizeof (libsstats_uptime));
+        
+	if (sysctl (mib, 2, &boottime, &size, NULL, 0) == -1)
+		return;
+	time (&now);
+    
+    buf->boot_time = boottime.tv_sec;
+	buf->uptime = now - boottime.tv_sec + 30;    
+}
+
+// -----------------------------------------------------------------------------
+#pragma mark Exporter
+// -----------------------------------------------------------------------------
+
+#define EXPORTER_VALUE_WIDTH    20
+#define EXPORTER_MAX_REQUEST    4096
+#define EXPORTER_MAX_CONNS      8
+#define EXPORTER_TIMEOUT        5.0
+#define EXPORTER_CONTENT_TYPE \
+"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/* The OpenMetrics text is rendered once per layout (set of CPUs and
+ * interfaces). Every value is printed zero-padded to a fixed width, so a
+ * scrape only rewrites the values that changed, in place, and never
+ * reformats names or labels. */
+typedef struct {
+    size_t      offset;
+    int         integer;
+    uint64_t    u;
+    double      d;
+} exporter_slot;
+
+typedef char exporter_ifname[IFNAMSIZ];
+
+enum {
+    EXPORTER_CONN_FREE = 0,
+    EXPORTER_CONN_READING,
+    EXPORTER_CONN_WRITING
+};
+
+/* A scrape in progress. Client sockets are non-blocking, so a slow or
+ * stalled client only holds its own slot, never the caller. The response
+ * is copied out because the shared text is rewritten on the next update. */
+typedef struct {
+    int         fd;
+    int         state;
+    double      start;
+    char        request[EXPORTER_MAX_REQUEST + 1];
+    size_t      request_len;
+    char        *response;
+    size_t      response_size;
+    size_t      response_capacity;
+    size_t      sent;
+    int         scrape;
+} exporter_conn;
+
+static struct {
+    int                 fd;
+    int                 rendering;
+    char                *text;
+    size_t              text_size;
+    size_t              text_capacity;
+    exporter_slot       *slots;
+    uint32_t            nslots;
+    uint32_t            slots_capacity;
+    uint32_t            cursor;
+    uint32_t            ncpu;
+    uint32_t            layout_ncpu;
+    uint32_t            nif;
+    uint32_t            if_capacity;
+    uint32_t            layout_nif;
+    exporter_ifname     *ifnames;
+    exporter_ifname     *layout_ifnames;
+    libsstats_netload   *netloads;
+    uint64_t            *ticks;
+    uint32_t            ticks_capacity;
+    uint64_t            memory[6];
+    unsigned char       *gz;
+    size_t              gz_size;
+    size_t              gz_capacity;
+    exporter_conn       conns[EXPORTER_MAX_CONNS];
+    libsstats_exporter  stats;
+} exporter = { -1 };
+
+static double
+exporter_now(void)
+{
+    struct timeval now;
+    
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+static int
+exporter_append(const char *s, size_t n)
+{
+    if (exporter.text_size + n > exporter.text_capacity) {
+        size_t capacity = exporter.text_capacity
+                        ? exporter.text_capacity : 64 * 1024;
+        char *text;
+        
+        while (exporter.text_size + n > capacity)
+            capacity *= 2;
+        text = (char *)realloc(exporter.text, capacity);
+        if (text == NULL)
+            return -1;
+        exporter.text = text;
+        exporter.text_capacity = capacity;
+    }
+    
+    memcpy(exporter.text + exporter.text_size, s, n);
+    exporter.text_size += n;
+    return 0;
+}
+
+static void
+exporter_format(char *dst, const exporter_slot *slot)
+{
+    char value[64];
+    int n;
+    
+    if (slot->integer) {
+        n = snprintf(value, sizeof (value), "%0*llu", EXPORTER_VALUE_WIDTH,
+                     (unsigned long long)slot->u);
+    }
+    else {
+        n = snprintf(value, sizeof (value), "%0*.6f", EXPORTER_VALUE_WIDTH,
+                     slot->d);
+        if (n > EXPORTER_VALUE_WIDTH)
+            n = snprintf(value, sizeof (value), "%0*.6e", EXPORTER_VALUE_WIDTH,
+                         slot->d);
+    }
+    
+    memcpy(dst, value, EXPORTER_VALUE_WIDTH);
+}
+
+static void
+exporter_family(const char *name, const char *type, const char *help)
+{
+    char line[256];
+    int n;
+    
+    if (!exporter.rendering)
+        return;
+    
+    n = snprintf(line, sizeof (line), "# TYPE %s %s\n# HELP %s %s\n",
+                 name, type, name, help);
+    exporter_append(line, n);
+}
+
+/* Renders one sample line, or while updating, rewrites the value of the
+ * sample at the same position if it changed. */
+static void
+exporter_sample(const char *name, const char *labels, int integer,
+                uint64_t u, double d)
+{
+    exporter_slot *slot;
+    
+    if (exporter.rendering) {
+        char line[256];
+        int n;
+        
+        if (exporter.nslots == exporter.slots_capacity) {
+            uint32_t capacity = exporter.slots_capacity
+                              ? exporter.slots_capacity * 2 : 1024;
+            exporter_slot *slots = (exporter_slot *)realloc(exporter.slots,
+                                        capacity * sizeof (exporter_slot));
+            if (slots == NULL)
+                return;
+            exporter.slots = slots;
+            exporter.slots_capacity = capacity;
+        }
+        
+        if (labels && *labels)
+            n = snprintf(line, sizeof (line), "%s{%s} ", name, labels);
+        else
+            n = snprintf(line, sizeof (line), "%s ", name);
+        if (n >= (int)sizeof (line) || exporter_append(line, n) < 0)
+            return;
+        
+        slot = &exporter.slots[exporter.nslots++];
+        slot->offset = exporter.text_size;
+        slot->integer = integer;
+        slot->u = u;
+        slot->d = d;
+        
+        if (exporter_append("00000000000000000000\n",
+                            EXPORTER_VALUE_WIDTH + 1) < 0)
+            return;
+        exporter_format(exporter.text + slot->offset, slot);
+        return;
+    }
+    
+    if (exporter.cursor >= exporter.nslots)
+        return;
+    
+    slot = &exporter.slots[exporter.cursor++];
+    if (integer ? slot->u == u : slot->d == d)
+        return;
+    
+    slot->u = u;
+    slot->d = d;
+    exporter_format(exporter.text + slot->offset, slot);
+}
+
+#define exporter_uint(name, labels, value) \
+    exporter_sample(name, labels, 1, value, 0)
+#define exporter_float(name, labels, value) \
+    exporter_sample(name, labels, 0, 0, value)
+
+/* One pass over the routing socket's interface list instead of one
+ * libsstats_get_netload() call, and one sysctl, per interface. */
+static void
+exporter_sample_netload(void)
+{
+	int mib[] = { CTL_NET, PF_ROUTE, 0, 0, NET_RT_IFLIST, 0 };
+    size_t bufsize;
+	char *rtbuf, *ptr, *eob;
+    
+    exporter.nif = 0;
+    
+	if (sysctl(mib, 6, NULL, &bufsize, NULL, 0) < 0)
+		return;
+	rtbuf = (char *)malloc(bufsize);
+	if (rtbuf == NULL)
+		return;
+	if (sysctl(mib, 6, rtbuf, &bufsize, NULL, 0) < 0) {
+		free(rtbuf);
+		return;
+	}
+    
+	eob = rtbuf + bufsize;
+	ptr = rtbuf;
+	while (ptr < eob) {
+		struct if_msghdr *ifm = (struct if_msghdr *)ptr;
+		struct sockaddr_dl *sdl;
+        size_t n;
+        
+		if (ifm->ifm_type != RTM_IFINFO)
+			break;
+		ptr += ifm->ifm_msglen;
+		while (ptr < eob
+               && ((struct if_msghdr *)ptr)->ifm_type == RTM_NEWADDR)
+			ptr += ((struct if_msghdr *)ptr)->ifm_msglen;
+        
+		sdl = (struct sockaddr_dl *)(ifm + 1);
+		if (sdl->sdl_family != AF_LINK)
+			continue;
+        
+        if (exporter.nif == exporter.if_capacity) {
+            uint32_t capacity = exporter.if_capacity
+                              ? exporter.if_capacity * 2 : 64;
+            exporter_ifname *names, *layout_names;
+            libsstats_netload *netloads;
+            
+            names = (exporter_ifname *)realloc(exporter.ifnames,
+                        capacity * sizeof (exporter_ifname));
+            if (names)
+                exporter.ifnames = names;
+            layout_names = (exporter_ifname *)realloc(exporter.layout_ifnames,
+                               capacity * sizeof (exporter_ifname));
+            if (layout_names)
+                exporter.layout_ifnames = layout_names;
+            netloads = (libsstats_netload *)realloc(exporter.netloads,
+                           capacity * sizeof (libsstats_netload));
+            if (netloads)
+                exporter.netloads = netloads;
+            if (!names || !layout_names || !netloads)
+                break;
+            exporter.if_capacity = capacity;
+        }
+        
+        n = sdl->sdl_nlen < IFNAMSIZ ? sdl->sdl_nlen : IFNAMSIZ - 1;
+        memset (exporter.ifnames[exporter.nif], 0, IFNAMSIZ);
+        memcpy(exporter.ifnames[exporter.nif], sdl->sdl_data, n);
+        memset (&exporter.netloads[exporter.nif], 0, sizeof (libsstats_netload));
+        netload_fill(&exporter.netloads[exporter.nif], ifm);
+        exporter.nif++;
+	}
+    
+	free (rtbuf);
+}
+
+/* Reads the per-CPU ticks straight from the host, since libsstats_cpu
+ * only has room for LIBSSTATS_NCPU processors. Four ticks per CPU, in
+ * the order user, nice, system, idle. */
+static void
+exporter_sample_cpu(void)
 {
-    if (curr_scanning)
-    {
+    processor_cpu_load_info_t pinfo;
+    mach_msg_type_number_t icount;
+    natural_t pcount, i;
+    
+    exporter.ncpu = 0;
+    
+    if (host_processor_info(mach_host_self(), PROCESSOR_CPU_LOAD_INFO,
+                            &pcount, (processor_info_array_t *)&pinfo,
+                            &icount) != KERN_SUCCESS)
         return;
+    
+    if (pcount > exporter.ticks_capacity) {
+        uint64_t *ticks = (uint64_t *)realloc(exporter.ticks,
+                              pcount * 4 * sizeof (uint64_t));
+        if (ticks == NULL) {
+            syslog(1, "libsysstats: Error: can't allocate CPU ticks.");
+            vm_deallocate(mach_task_self(), (vm_address_t)pinfo, icount);
+            return;
+        }
+        exporter.ticks = ticks;
+        exporter.ticks_capacity = pcount;
     }
-    curr_scanning = 1;
+    
+    for (i = 0; i < pcount; i++) {
+        exporter.ticks[i * 4 + 0] = pinfo[i].cpu_ticks[CPU_STATE_USER];
+        exporter.ticks[i * 4 + 1] = pinfo[i].cpu_ticks[CPU_STATE_NICE];
+        exporter.ticks[i * 4 + 2] = pinfo[i].cpu_ticks[CPU_STATE_SYSTEM];
+        exporter.ticks[i * 4 + 3] = pinfo[i].cpu_ticks[CPU_STATE_IDLE];
+    }
+    exporter.ncpu = pcount;
+    
+    vm_deallocate(mach_task_self(), (vm_address_t)pinfo, icount);
+}
 
-    memset (buf, 0, sizeof (libsstats_wireless));
-   
-    typedef int (*open_h)(void *);
-    typedef int (*close_h)(void *);
-    typedef int (*bind_h)(void *, CFStringRef);
-    typedef int (*scan_h)(void *, CFArrayRef *, void *);
+/* In bytes from the page counts, in the order of the states in
+ * exporter_walk(); libsstats_mem only has rounded megabytes. */
+static void
+exporter_sample_memory(void)
+{
+	vm_statistics_data_t vm_info;
+	mach_msg_type_number_t info_count = HOST_VM_INFO_COUNT;
+    uint64_t page = vm_page_size;
+    
+    memset (exporter.memory, 0, sizeof (exporter.memory));
+    
+	if (host_statistics(mach_host_self(), HOST_VM_INFO,
+                        (host_info_t)&vm_info, &info_count))
+		return;
+    
+    exporter.memory[0] = (uint64_t)(vm_info.active_count
+                                    + vm_info.inactive_count
+                                    + vm_info.free_count
+                                    + vm_info.wire_count) * page;
+    exporter.memory[2] = (uint64_t)vm_info.free_count * page;
+    exporter.memory[1] = exporter.memory[0] - exporter.memory[2];
+    exporter.memory[3] = (uint64_t)vm_info.active_count * page;
+    exporter.memory[4] = (uint64_t)vm_info.inactive_count * page;
+    exporter.memory[5] = (uint64_t)vm_info.wire_count * page;
+}
 
-    open_h o;
-    close_h c;
-    bind_h b;
-    scan_h s;
+static void
+exporter_sample_all(void)
+{
+    exporter_sample_cpu();
+    exporter_sample_memory();
+    exporter_sample_netload();
+}
+
+static void
+exporter_walk(void)
+{
+    static const char *modes[] = { "user", "nice", "system", "idle" };
+    static const char *states[] = {
+        "total", "used", "free", "active", "inactive", "wired"
+    };
+    char labels[128];
+    uint32_t i, j;
     
-    void *handle = dlopen(IPCONFIGURATION_BUNDLE_PATH, RTLD_LAZY);
-    if (!handle) goto DONE;
+    exporter_family("libsstats_cpu_ticks", "counter",
+                    "Clock ticks spent per CPU and mode.");
+    for (i = 0; i < exporter.ncpu; i++) {
+        for (j = 0; j < 4; j++) {
+            snprintf(labels, sizeof (labels), "cpu=\"%u\",mode=\"%s\"",
+                     i, modes[j]);
+            exporter_uint("libsstats_cpu_ticks_total", labels,
+                          exporter.ticks[i * 4 + j]);
+        }
+    }
     
-    *(void **)(&o) = dlsym(handle, "Apple80211Open");
-    if (!o) goto DONE;
+    exporter_family("libsstats_memory_bytes", "gauge",
+                    "Memory by state, in bytes.");
+    for (j = 0; j < 6; j++) {
+        snprintf(labels, sizeof (labels), "state=\"%s\"", states[j]);
+        exporter_uint("libsstats_memory_bytes", labels, exporter.memory[j]);
+    }
     
-    *(void **)(&c) = dlsym(handle, "Apple80211Close");
-    if (!c) goto DONE;
+#define EXPORTER_NET_FAMILY(name, help, field) \
+    exporter_family(name, "counter", help); \
+    for (i = 0; i < exporter.nif; i++) { \
+        snprintf(labels, sizeof (labels), "interface=\"%s\"", \
+                 exporter.ifnames[i]); \
+        exporter_uint(name "_total", labels, exporter.netloads[i].field); \
+    }
     
-    *(void **)(&b) = dlsym(handle, "Apple80211BindToInterface");
-    if (!b) goto DONE;
+    EXPORTER_NET_FAMILY("libsstats_network_receive_bytes",
+                        "Bytes received per interface.", bytes_in)
+    EXPORTER_NET_FAMILY("libsstats_network_transmit_bytes",
+                        "Bytes sent per interface.", bytes_out)
+    EXPORTER_NET_FAMILY("libsstats_network_receive_packets",
+                        "Packets received per interface.", packets_in)
+    EXPORTER_NET_FAMILY("libsstats_network_transmit_packets",
+                        "Packets sent per interface.", packets_out)
+    EXPORTER_NET_FAMILY("libsstats_network_receive_errors",
+                        "Receive errors per interface.", errors_in)
+    EXPORTER_NET_FAMILY("libsstats_network_transmit_errors",
+                        "Transmit errors per interface.", errors_out)
+    EXPORTER_NET_FAMILY("libsstats_network_collisions",
+                        "Collisions per interface.", collisions)
     
-    *(void **)(&s) = dlsym(handle, "Apple80211Scan");
-    if (!s) goto DONE;
+#undef EXPORTER_NET_FAMILY
     
-    CFDictionaryRef parameters
-    = CFDictionaryCreateMutable(
-        NULL,
-        0,
-        &kCFTypeDictionaryKeyCallBacks,
-        &kCFTypeDictionaryValueCallBacks
-    );
+    exporter_family("libsstats_exporter_scrapes", "counter",
+                    "Scrapes served.");
+    exporter_uint("libsstats_exporter_scrapes_total", NULL,
+                     exporter.stats.scrapes);
+    exporter_family("libsstats_exporter_scrape_duration_seconds", "gauge",
+                    "Time taken by the previous scrape.");
+    exporter_float("libsstats_exporter_scrape_duration_seconds", NULL,
+                   exporter.stats.scrape_seconds);
+    exporter_family("libsstats_exporter_scrape_bytes", "gauge",
+                    "Bytes sent by the previous scrape.");
+    exporter_uint("libsstats_exporter_scrape_bytes", NULL,
+                     exporter.stats.scrape_bytes);
     
-    int retval;
+    if (exporter.rendering)
+        exporter_append("# EOF\n", 6);
+}
+
+/* Samples everything and brings the text up to date. The text is only
+ * rendered again when CPUs or interfaces came or went. */
+static void
+exporter_update(void)
+{
+    exporter_sample_all();
     
-    // Open
-    retval = o(&handle);
-    if (retval) goto DONE;
+    exporter.rendering = (exporter.text_size == 0
+                          || exporter.layout_ncpu != exporter.ncpu
+                          || exporter.layout_nif != exporter.nif
+                          || (exporter.nif
+                              && memcmp(exporter.layout_ifnames,
+                                        exporter.ifnames,
+                                        exporter.nif * sizeof (exporter_ifname))));
+    if (exporter.rendering) {
+        exporter.text_size = 0;
+        exporter.nslots = 0;
+    }
+    exporter.cursor = 0;
     
-    // Bind
-    retval = b(handle, CFSTR("en0"));
-    if (retval) goto DONE;
+    exporter_walk();
     
-    CFArrayRef networks;
+    if (exporter.rendering) {
+        if (exporter.nif)
+            memcpy(exporter.layout_ifnames, exporter.ifnames,
+                   exporter.nif * sizeof (exporter_ifname));
+        exporter.layout_nif = exporter.nif;
+        exporter.layout_ncpu = exporter.ncpu;
+        exporter.stats.series = exporter.nslots;
+        exporter.rendering = 0;
+    }
+    exporter.stats.body_bytes = exporter.text_size;
+}
 
-    // Scan
-    retval = s(handle, &networks, (void *)parameters);
-    if (retval) goto DONE;
+/* gzip of the current text. The self-metrics change on every scrape, so
+ * there is nothing to reuse from the previous one. */
+static int
+exporter_deflate(void)
+{
+    z_stream z;
+    size_t bound;
+    int ret;
     
-    // Info
-    int i;
-    for (i = 0; i < CFArrayGetCount(networks) && i < 256; i++) {
-        CFDictionaryRef network
-        = (CFDictionaryRef)CFArrayGetValueAtIndex(networks, i);
-        buf->networks[i] = network;
-        buf->number++;
+    memset (&z, 0, sizeof (z));
+    if (deflateInit2(&z, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    
+    bound = deflateBound(&z, exporter.text_size);
+    if (bound > exporter.gz_capacity) {
+        unsigned char *gz = (unsigned char *)realloc(exporter.gz, bound);
+        if (gz == NULL) {
+            deflateEnd(&z);
+            return -1;
+        }
+        exporter.gz = gz;
+        exporter.gz_capacity = bound;
     }
     
-    // Close
-    c(handle);
-    dlclose(handle);    
+    z.next_in = (Bytef *)exporter.text;
+    z.avail_in = (uInt)exporter.text_size;
+    z.next_out = exporter.gz;
+    z.avail_out = (uInt)exporter.gz_capacity;
+    ret = deflate(&z, Z_FINISH);
+    exporter.gz_size = z.total_out;
+    deflateEnd(&z);
     
-DONE:
-    curr_scanning = 0;
+    if (ret != Z_STREAM_END)
+        return -1;
+    return 0;
 }
 
-// -----------------------------------------------------------------------------
-#pragma mark Cellular Data
-// -----------------------------------------------------------------------------
+#ifdef MSG_NOSIGNAL
+#define EXPORTER_SEND_FLAGS     MSG_NOSIGNAL
+#else
+#define EXPORTER_SEND_FLAGS     0
+#endif
 
-void
-libsstats_get_cellular(libsstats_cellular *buf)
+static void
+exporter_conn_close(exporter_conn *conn)
 {
-    memset (buf, 0, sizeof(libsstats_cellular));
-    void *libHandle = dlopen(CORE_TELEPHONY_PATH, RTLD_LAZY);
-	
-    int (*CTGetSignalStrength)();
-	CTGetSignalStrength = dlsym(libHandle, "CTGetSignalStrength");
-	if (CTGetSignalStrength == NULL) return;	
-	
-    buf->rssi = CTGetSignalStrength();
-	
-    dlclose(libHandle);	
+    close(conn->fd);
+    conn->fd = -1;
+    conn->state = EXPORTER_CONN_FREE;
 }
 
-void libsstats_get_processinfo(libsstats_processinfo *buf)
+/* Only "GET /metrics" and "GET /" are scrapes. */
+static int
+exporter_is_scrape(const char *request)
 {
-    int mib[5];
-    struct kinfo_proc *procs = NULL, *newprocs;
-    int i, st, nprocs;
-    size_t miblen, size;
+    const char *path = request + 4;
+    size_t n;
     
-    memset (buf, 0, sizeof (libsstats_processinfo));
+    if (strncmp(request, "GET ", 4) != 0)
+        return 0;
+    
+    n = strcspn(path, " ?\r\n");
+    return (n == 1 && path[0] == '/')
+        || (n == 8 && strncmp(path, "/metrics", 8) == 0);
+}
 
-    mib[0] = CTL_KERN;
-    mib[1] = KERN_PROC;
-    mib[2] = KERN_PROC_ALL;
-    mib[3] = 0;
-    miblen = 4;
+/* Samples, renders and copies the whole response into the connection. */
+static int
+exporter_respond(exporter_conn *conn)
+{
+    char header[256], *p;
+    const char *body = NULL;
+    size_t body_len = 0;
+    int gzip = 0, header_len;
     
-    st = sysctl(mib, miblen, NULL, &size, NULL, 0);
-    do {
-        size += size / 10;
-        newprocs = realloc(procs, size);
-        if (!newprocs) {
-            if (procs) {
-                free(procs);
+    /* Probes and stray clients don't cost a sample and render. */
+    conn->scrape = exporter_is_scrape(conn->request);
+    if (!conn->scrape) {
+        header_len = snprintf(header, sizeof (header),
+                              "HTTP/1.1 404 Not Found\r\n"
+                              "Content-Length: 0\r\n"
+                              "Connection: close\r\n\r\n");
+        goto RESPOND;
+    }
+    
+    for (p = conn->request; *p; p++) {
+        if (*p >= 'A' && *p <= 'Z')
+            *p += 'a' - 'A';
+    }
+    p = strstr(conn->request, "\naccept-encoding:");
+    if (p) {
+        char *eol = strchr(p + 1, '\n');
+        char *gz = strstr(p, "gzip");
+        gzip = (gz != NULL && (eol == NULL || gz < eol));
+    }
+    
+    exporter_update();
+    
+    body = exporter.text;
+    body_len = exporter.text_size;
+    if (gzip && exporter_deflate() == 0) {
+        body = (const char *)exporter.gz;
+        body_len = exporter.gz_size;
+    }
+    else {
+        gzip = 0;
+    }
+    
+    header_len = snprintf(header, sizeof (header),
+                          "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: " EXPORTER_CONTENT_TYPE "\r\n"
+                          "Content-Length: %lu\r\n"
+                          "%s"
+                          "Connection: close\r\n\r\n",
+                          (unsigned long)body_len,
+                          gzip ? "Content-Encoding: gzip\r\n" : "");
+    
+RESPOND:
+    if (header_len + body_len > conn->response_capacity) {
+        char *response = (char *)realloc(conn->response,
+                                         header_len + body_len);
+        if (response == NULL) {
+            syslog(1, "libsysstats: Error: can't allocate exporter response.");
+            return -1;
+        }
+        conn->response = response;
+        conn->response_capacity = header_len + body_len;
+    }
+    
+    /* Header and body in one buffer, so Nagle doesn't hold back the body. */
+    memcpy(conn->response, header, header_len);
+    if (body_len)
+        memcpy(conn->response + header_len, body, body_len);
+    conn->response_size = header_len + body_len;
+    conn->sent = 0;
+    return 0;
+}
+
+/* Moves one connection along as far as it goes without blocking. */
+static void
+exporter_conn_step(exporter_conn *conn, double now)
+{
+    ssize_t n;
+    
+    if (now - conn->start > EXPORTER_TIMEOUT) {
+        exporter_conn_close(conn);
+        return;
+    }
+    
+    /* Only the request headers matter; there is no body for GET. */
+    while (conn->state == EXPORTER_CONN_READING) {
+        n = recv(conn->fd, conn->request + conn->request_len,
+                 EXPORTER_MAX_REQUEST - conn->request_len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0) {
+            exporter_conn_close(conn);
+            return;
+        }
+        conn->request_len += n;
+        conn->request[conn->request_len] = '\0';
+        if (strstr(conn->request, "\r\n\r\n")
+            || conn->request_len == EXPORTER_MAX_REQUEST) {
+            if (exporter_respond(conn) < 0) {
+                exporter_conn_close(conn);
+                return;
             }
-            
-            syslog(1, "libsysstats: Error: realloc failed.");
+            conn->state = EXPORTER_CONN_WRITING;
+        }
+    }
+    
+    while (conn->sent < conn->response_size) {
+        n = send(conn->fd, conn->response + conn->sent,
+                 conn->response_size - conn->sent, EXPORTER_SEND_FLAGS);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0) {
+            exporter_conn_close(conn);
             return;
         }
-        
-        procs = newprocs;
-        st = sysctl(mib, miblen, procs, &size, NULL, 0);
-    } while (st == -1 && errno == ENOMEM);
+        conn->sent += n;
+    }
     
-    if (st != 0) {
-        syslog(1, "libsysstats: Error: sysctl(KERN_PROC) failed.");
-        return;
+    if (conn->scrape) {
+        exporter.stats.scrapes++;
+        exporter.stats.scrape_bytes = conn->response_size;
+        exporter.stats.scrape_seconds = exporter_now() - conn->start;
     }
+    exporter_conn_close(conn);
+}
+
+/* Listens on 127.0.0.1:port. Returns the descriptor; see
+ * libsstats_exporter_pollfds() for what to wait on. */
+int
+libsstats_exporter_open(uint16_t port)
+{
+    struct sockaddr_in addr;
+    int fd, on = 1;
+    unsigned i;
     
-    if (size % sizeof(struct kinfo_proc) != 0) {
-        return;
+    if (exporter.fd >= 0)
+        return exporter.fd;
+    
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof (addr)) < 0
+        || listen(fd, 16) < 0
+        || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+        syslog(1, "libsysstats: Error: exporter can't listen on port %u.",
+               port);
+        close(fd);
+        return -1;
     }
-    nprocs = size / sizeof(struct kinfo_proc);
     
-    if (!nprocs) {
-        syslog(1, "libsysstats: !nprocs");
-        return;
+    for (i = 0; i < EXPORTER_MAX_CONNS; i++) {
+        exporter.conns[i].fd = -1;
+        exporter.conns[i].state = EXPORTER_CONN_FREE;
     }
+    exporter.fd = fd;
+    return fd;
+}
 
-    /* Get all processes. */
-    for (i = nprocs - 1; i >= 0;  i--) {
-        time_t now;
-        libsstats_process proc;
-        strncpy(proc.name, procs[i].kp_proc.p_comm, 256 - 1);
-        proc.pid = (int)procs[i].kp_proc.p_pid;
-        proc.priority = (u_char)(procs[i].kp_proc.p_priority);
+/* Fills fds with what the exporter is waiting on: the listening socket
+ * while a connection slot is free, and every scrape in progress. Returns
+ * the number of entries, at most EXPORTER_MAX_CONNS + 1; poll them with a
+ * timeout of a second or so and call libsstats_exporter_serve(). */
+unsigned
+libsstats_exporter_pollfds(struct pollfd *fds, unsigned nfds)
+{
+    unsigned i, n = 0, busy = 0;
+    
+    if (exporter.fd < 0)
+        return 0;
+    
+    for (i = 0; i < EXPORTER_MAX_CONNS && n < nfds; i++) {
+        exporter_conn *conn = &exporter.conns[i];
         
-        time (&now);
+        if (conn->state == EXPORTER_CONN_FREE)
+            continue;
+        busy++;
+        fds[n].fd = conn->fd;
+        fds[n].events = conn->state == EXPORTER_CONN_READING
+                      ? POLLIN : POLLOUT;
+        fds[n].revents = 0;
+        n++;
+    }
+    
+    if (busy < EXPORTER_MAX_CONNS && n < nfds) {
+        fds[n].fd = exporter.fd;
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        n++;
+    }
+    
+    return n;
+}
 
-        proc.run_time = now - procs[i].kp_proc.p_starttime.tv_sec;
+/* Accepts waiting scrapes while connection slots are free, then moves
+ * every scrape along without blocking. Connections beyond the free slots
+ * stay in the listen backlog until the next call. */
+void
+libsstats_exporter_serve(void)
+{
+    double now;
+    unsigned i;
+    
+    if (exporter.fd < 0)
+        return;
+    
+    now = exporter_now();
+    
+    for (i = 0; i < EXPORTER_MAX_CONNS; i++) {
+        exporter_conn *conn = &exporter.conns[i];
+        int fd;
         
-        switch (procs[i].kp_proc.p_stat) {
-        case SIDL:
-            proc.state = LIBSSTATS_PROC_IDLE;
-            break;
-        case SRUN:
-            proc.state = LIBSSTATS_PROC_RUN;
-            break;
-        case SSLEEP:
-            proc.state = LIBSSTATS_PROC_SLEEP;
-            break;
-        case SSTOP:
-            proc.state = LIBSSTATS_PROC_STOP;
-            break;
-        case SZOMB:
-            proc.state = LIBSSTATS_PROC_ZOMBIE;
-            break;
-        default:
-            proc.state = LIBSSTATS_PROC_UNKNOWN;
+        if (conn->state != EXPORTER_CONN_FREE)
+            continue;
+        
+        fd = accept(exporter.fd, NULL, NULL);
+        if (fd < 0)
             break;
+        
+        /* BSD sockets inherit O_NONBLOCK from the listener, Linux ones
+         * don't. */
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+            close(fd);
+            continue;
+        }
+#ifdef SO_NOSIGPIPE
+        {
+            int on = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof (on));
         }
+#endif
         
-        buf->processes[buf->number] = proc;
-        buf->number++;
+        conn->fd = fd;
+        conn->state = EXPORTER_CONN_READING;
+        conn->start = now;
+        conn->request_len = 0;
+        conn->request[0] = '\0';
+        conn->response_size = 0;
+        conn->sent = 0;
+        conn->scrape = 0;
     }
     
-    free(procs);
+    for (i = 0; i < EXPORTER_MAX_CONNS; i++) {
+        if (exporter.conns[i].state != EXPORTER_CONN_FREE)
+            exporter_conn_step(&exporter.conns[i], now);
+    }
 }
 
-// -----------------------------------------------------------------------------
-#pragma mark Uptime
-// -----------------------------------------------------------------------------
-
-void libsstats_get_uptime(libsstats_uptime *buf)
+void
+libsstats_exporter_close(void)
 {
-    int mib[] = { CTL_KERN, KERN_BOOTTIME };
-	struct timeval boottime;
-	size_t size = sizeof (boottime);
-	time_t now;
-    	
-	memset (buf, 0, sizeof (libsstats_uptime));
-        
-	if (sysctl (mib, 2, &boottime, &size, NULL, 0) == -1)
-		return;
-	time (&now);
+    unsigned i;
     
-    buf->boot_time = boottime.tv_sec;
-	buf->uptime = now - boottime.tv_sec + 30;    
+    if (exporter.fd < 0)
+        return;
+    
+    for (i = 0; i < EXPORTER_MAX_CONNS; i++) {
+        if (exporter.conns[i].state != EXPORTER_CONN_FREE)
+            exporter_conn_close(&exporter.conns[i]);
+        free(exporter.conns[i].response);
+        exporter.conns[i].response = NULL;
+        exporter.conns[i].response_capacity = 0;
+    }
+    
+    close(exporter.fd);
+    exporter.fd = -1;
+}
+
+void
+libsstats_get_exporter(libsstats_exporter *buf)
+{
+    *buf = exporter.stats;
 }
 
 #ifdef __cplusplus
@@ -12,6 +12,7 @@ extern "C" {
 #endif
     
 #include <stdint.h>
+#include <poll.h>
 #include <CoreFoundation/CoreFoundation.h> // CFDictionaryRef
 
 #define LIBSSTATS_NCPU              32
@@ -25,6 +26,16 @@ extern "C" {
 
 #define LIBSSTATS_MAX_NAMELEN       256
 
+#define LIBSSTATS_TCP_NSTATES       11
+#define LIBSSTATS_MAX_SOCKPORTS     32
+#define LIBSSTATS_MAX_SOCKPEERS     32
+
+#define LIBSSTATS_MAX_THERMALNAMELEN 32
+
+#define LIBSSTATS_MAX_IRQNAMELEN    16
+#define LIBSSTATS_MAX_IRQDESCLEN    64
+#define LIBSSTATS_MAX_IRQACTIONLEN  64
+
 enum {
 	LIBSSTATS_IF_FLAGS_UP = 1,
 	LIBSSTATS_IF_FLAGS_BROADCAST,
@@ -90,13 +101,112 @@ typedef struct {
     float idle_cpu_percentage;
 } libsstats_cpu_percentage;
 
+/* Frequencies are in kHz, temperatures in millidegrees Celsius. Fields
+ * the hardware doesn't report are 0. On Linux every field comes from
+ * sysfs. On Darwin every core gets the nominal clock from
+ * hw.cpufrequency, hw.cpufrequency_min and hw.cpufrequency_max, which
+ * only Intel Macs have; on iOS and Apple silicon the frequencies stay 0.
+ * The throttle counts are always 0 on Darwin. */
+typedef struct {
+	uint32_t cpu;
+	uint64_t cur_freq;
+	uint64_t min_freq;
+	uint64_t max_freq;
+	uint64_t core_throttle_count;
+	uint64_t package_throttle_count;
+} libsstats_corefreq;
+
+typedef struct {
+	char     type[LIBSSTATS_MAX_THERMALNAMELEN];
+	int64_t  temp;
+} libsstats_thermal;
+
+/* Thermal pressure levels, as posted by Darwin's thermal notification. */
+enum {
+	LIBSSTATS_THERMAL_NOMINAL = 0,
+	LIBSSTATS_THERMAL_MODERATE,
+	LIBSSTATS_THERMAL_HEAVY,
+	LIBSSTATS_THERMAL_TRAPPING,
+	LIBSSTATS_THERMAL_SLEEPING
+};
+
+/* `cores' and `zones' are owned by the library and stay valid until the
+ * next call of libsstats_get_cpufreq(). Thermal zones are Linux only, so
+ * nzones is 0 on Darwin. thermal_level is Darwin only and is the one
+ * value there that shows the cores being throttled; it is 0 on Linux. */
+typedef struct {
+	uint32_t            ncpu;
+	libsstats_corefreq *cores;
+	uint32_t            nzones;
+	libsstats_thermal  *zones;
+	uint32_t            thermal_level;
+} libsstats_cpufreq;
+
+/* One row of /proc/interrupts or /proc/softirqs, which only Linux has;
+ * on Darwin both getters return ncpu == 0 and no rows, so ncpu == 0
+ * means "unsupported" rather than "no interrupts". `desc' is the rest of
+ * the row after the counters and may be cut short; `action' is its last
+ * word, the device or handler name, for numbered IRQs only. The per-CPU
+ * arrays have `ncpu' entries and are owned by the library; they stay
+ * valid until the next call of the same getter. */
+typedef struct {
+	char      name[LIBSSTATS_MAX_IRQNAMELEN];
+	char      desc[LIBSSTATS_MAX_IRQDESCLEN];
+	char      action[LIBSSTATS_MAX_IRQACTIONLEN];
+	uint64_t  total;
+	double    rate;
+	uint64_t *xcpu_count;
+	double   *xcpu_rate;
+} libsstats_irq;
+
+typedef struct {
+	uint32_t       number;
+	uint32_t       ncpu;
+	uint64_t       total;
+	double         rate;
+	uint64_t      *xcpu_total;
+	double        *xcpu_rate;
+	libsstats_irq *irqs;
+} libsstats_interrupts;
+
+/* nr_tasks and nr_threads are the scheduler's counts from
+ * processor_set_statistics(). nr_running is the number of processes in
+ * SRUN, which on Darwin includes processes whose threads are all waiting,
+ * and last_pid the pid of the most recently started process that is
+ * still alive. */
 typedef struct {
 	double   loadavg [3];
 	uint64_t nr_running;
 	uint64_t nr_tasks;
 	uint64_t last_pid;
+	uint64_t nr_threads;
 } libsstats_loadavg;
 
+/* Run-queue times are in nanoseconds, as reported by /proc/schedstat.
+ * Rates are per second since the previous call; xcpu_wait_rate is run-queue
+ * wait per second and xcpu_wait_per_slice the average wait before a task
+ * got the CPU. The per-CPU arrays have `ncpu' entries and are owned by the
+ * library; they stay valid until the next call. Darwin has no source for
+ * ctxt, forks, procs_blocked or any per-CPU field: there only
+ * procs_running is filled in (see libsstats_loadavg) and ncpu is 0. */
+typedef struct {
+	uint64_t  ctxt;
+	uint64_t  forks;
+	uint64_t  procs_running;
+	uint64_t  procs_blocked;
+	double    ctxt_rate;
+	double    forks_rate;
+	uint32_t  ncpu;
+	uint64_t *xcpu_ctxt;
+	uint64_t *xcpu_run_time;
+	uint64_t *xcpu_wait_time;
+	uint64_t *xcpu_timeslices;
+	double   *xcpu_ctxt_rate;
+	double   *xcpu_wait_rate;
+	double   *xcpu_wait_per_slice;
+	double   *xcpu_timeslice_rate;
+} libsstats_sched;
+
 typedef struct {
 	uint32_t number;
 } libsstats_netlist;
@@ -127,6 +237,42 @@ typedef struct {
 	uint8_t hwaddress[8];
 } libsstats_netload;
 
+enum LIBSSTATS_TCP_STATE {
+	LIBSSTATS_TCP_CLOSED = 0,
+	LIBSSTATS_TCP_LISTEN,
+	LIBSSTATS_TCP_SYN_SENT,
+	LIBSSTATS_TCP_SYN_RECEIVED,
+	LIBSSTATS_TCP_ESTABLISHED,
+	LIBSSTATS_TCP_CLOSE_WAIT,
+	LIBSSTATS_TCP_FIN_WAIT_1,
+	LIBSSTATS_TCP_CLOSING,
+	LIBSSTATS_TCP_LAST_ACK,
+	LIBSSTATS_TCP_FIN_WAIT_2,
+	LIBSSTATS_TCP_TIME_WAIT
+};
+
+typedef struct {
+	uint16_t port;
+	uint64_t count;
+} libsstats_sockport;
+
+typedef struct {
+	uint8_t  address6[16];
+	uint64_t count;
+} libsstats_sockpeer;
+
+/* tcp_states is indexed by enum LIBSSTATS_TCP_STATE. Peer addresses are
+ * IPv6, IPv4 peers mapped into ::ffff:0:0/96. */
+typedef struct {
+	uint64_t           tcp_total;
+	uint64_t           udp_total;
+	uint64_t           tcp_states[LIBSSTATS_TCP_NSTATES];
+	uint32_t           nports;
+	libsstats_sockport ports[LIBSSTATS_MAX_SOCKPORTS];
+	uint32_t           npeers;
+	libsstats_sockpeer peers[LIBSSTATS_MAX_SOCKPEERS];
+} libsstats_sockets;
+
 typedef struct {
     char macaddress[18];
 } libsstats_mac;
@@ -166,17 +312,67 @@ typedef struct {
     libsstats_process   processes[LIBSSTATS_MAX_PROCESSES];
 } libsstats_processinfo;
 
+enum {
+    LIBSSTATS_QUERY_NAME        = 1 << 0,
+    LIBSSTATS_QUERY_STATE       = 1 << 1,
+    LIBSSTATS_QUERY_UID         = 1 << 2,
+    LIBSSTATS_QUERY_PIDS        = 1 << 3,
+    LIBSSTATS_QUERY_RUN_TIME    = 1 << 4
+};
+
+/* Only the predicates set in `flags' are checked. `name' is a prefix of
+ * the command name, or a fnmatch(3) pattern if it contains * ? or [.
+ * With LIBSSTATS_QUERY_PIDS, the first `number' pids (at most
+ * LIBSSTATS_MAX_PROCESSES) are looked up in ascending order and each
+ * pid is reported once. */
+typedef struct {
+    uint64_t    flags;
+    char        name[LIBSSTATS_MAX_NAMELEN];
+    proc_state  state;
+    uint32_t    uid;
+    time_t      min_run_time;
+    uint32_t    number;
+    uint32_t    pids[LIBSSTATS_MAX_PROCESSES];
+} libsstats_proc_query;
+
+/* Sizes in bytes, from proc_pid_rusage(). footprint is the memory the
+ * kernel charges to the process (private dirty plus compressed pages),
+ * the figure to use for chargeback; Darwin has no proportional (PSS)
+ * accounting of shared pages. stamp is when the values were read. */
+typedef struct {
+    uint32_t    pid;
+    uint64_t    rss;
+    uint64_t    footprint;
+    uint64_t    wired;
+    double      stamp;
+} libsstats_procmem;
+
 typedef struct {
     double uptime;
     double boot_time;
 } libsstats_uptime;
 
+/* Self-monitoring of the OpenMetrics exporter. The scrape figures are
+ * those of the most recent scrape; scrape_seconds runs from accepting the
+ * connection to sending the last byte. */
+typedef struct {
+    uint64_t scrapes;
+    double   scrape_seconds;
+    uint64_t scrape_bytes;
+    uint64_t body_bytes;
+    uint32_t series;
+} libsstats_exporter;
+
 typedef union  {
     libsstats_cpu               cpu;
     libsstats_cpu_percentage    cpu_percentage;
+    libsstats_cpufreq           cpufreq;
+    libsstats_interrupts        interrupts;
     libsstats_loadavg           loadavg;
+    libsstats_sched             sched;
     libsstats_netlist           netlist;
     libsstats_netload           netload;
+    libsstats_sockets           sockets;
     libsstats_mac               mac;
     libsstats_ip                ip;
     libsstats_mem               mem;
@@ -184,21 +380,37 @@ typedef union  {
     libsstats_cellular          cellular;;
     libsstats_process           process;
     libsstats_processinfo       processinfo;
+    libsstats_procmem           procmem;
     libsstats_uptime            uptime;
+    libsstats_exporter          exporter;
 } libsstats_union;
 
 void libsstats_get_cpu(libsstats_cpu *buf);
 void libsstats_get_cpu_percentage(libsstats_cpu cpu, libsstats_cpu_percentage *buf, unsigned cpu_idx);
+void libsstats_get_cpufreq(libsstats_cpufreq *buf);
+void libsstats_get_interrupts(libsstats_interrupts *buf);
+void libsstats_get_softirqs(libsstats_interrupts *buf);
 void libsstats_get_loadavg(libsstats_loadavg *buf);
+void libsstats_get_sched(libsstats_sched *buf);
 char **libsstats_get_netlist(libsstats_netlist *buf);
 void libsstats_get_netload(libsstats_netload *buf, const char *intf);
+void libsstats_get_sockets(libsstats_sockets *buf);
 void libsstats_get_mac(const char *intf, libsstats_mac *buf);
 void libsstats_get_ip(const char *intf, libsstats_ip *buf);     
 void libsstats_get_mem(libsstats_mem *buf);
 void libsstats_get_wireless(libsstats_wireless *buf);
 void libsstats_get_cellular(libsstats_cellular *buf);
 void libsstats_get_processinfo(libsstats_processinfo *buf);
+void libsstats_query_processinfo(const libsstats_proc_query *query, libsstats_processinfo *buf);
+void libsstats_get_procmem(uint32_t pid, libsstats_procmem *buf);
+void libsstats_set_procmem_ttl(double seconds);
+void libsstats_refresh_procmem(unsigned budget);
 void libsstats_get_uptime(libsstats_uptime *buf);
+int  libsstats_exporter_open(uint16_t port);
+unsigned libsstats_exporter_pollfds(struct pollfd *fds, unsigned nfds);
+void libsstats_exporter_serve(void);
+void libsstats_exporter_close(void);
+void libsstats_get_exporter(libsstats_exporter *buf);
 
 #ifdef __cplusplus
 }